@@ -0,0 +1,141 @@
+/*
+ * cpu_topology.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "cpu_topology.hpp"
+
+#include <fstream>
+#include <new>
+#include <string>
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef LOGGER_NUMA
+#include <numa.h>
+#endif
+
+#define NODE_SYSFS "/sys/devices/system/node/node"
+
+int numa_node_count()
+{
+#ifdef LOGGER_NUMA
+    if (numa_available() >= 0)
+        return numa_max_node() + 1;
+#endif
+    int count = 0;
+    while (std::ifstream(NODE_SYSFS + std::to_string(count) + "/cpulist"))
+        count++;
+    return count > 0 ? count : 1;
+}
+
+/* Parse a cpu list, i.e. "0-3,8-11" */
+std::vector<int> numa_node_cpus(int node)
+{
+    std::vector<int> cpus;
+
+#ifdef LOGGER_NUMA
+    if (numa_available() >= 0) {
+        struct bitmask* mask = numa_allocate_cpumask();
+        if (numa_node_to_cpus(node, mask) == 0)
+            for (unsigned int cpu = 0; cpu < mask->size; cpu++)
+                if (numa_bitmask_isbitset(mask, cpu))
+                    cpus.push_back(cpu);
+        numa_free_cpumask(mask);
+        return cpus;
+    }
+#endif
+    std::ifstream list(NODE_SYSFS + std::to_string(node) + "/cpulist");
+    std::string range;
+    while (std::getline(list, range, ',')) {
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range);
+            int last = dash == std::string::npos ? first :
+                                            std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        } catch (const std::exception&) {
+            break;      // empty node, or unknown format
+        }
+    }
+    return cpus;
+}
+
+int current_numa_node()
+{
+    unsigned int cpu, node;
+
+    // getcpu() wrapper is only in recent glibc
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return 0;
+    return node;
+}
+
+bool pin_thread(pthread_t thread, const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            return false;
+        CPU_SET(cpu, &set);
+    }
+    if (CPU_COUNT(&set) == 0)
+        return false;
+
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+void prefer_numa_node(int node)
+{
+#ifdef LOGGER_NUMA
+    if (numa_available() >= 0)
+        numa_set_preferred(node);
+#else
+    (void)node;
+#endif
+}
+
+void* alloc_on_node(size_t size, int node)
+{
+#ifdef LOGGER_NUMA
+    if (node >= 0 && numa_available() >= 0) {
+        void* mem = numa_alloc_onnode(size, node);
+        if (!mem)
+            throw std::bad_alloc();
+        return mem;
+    }
+#else
+    (void)node;
+#endif
+    return ::operator new(size);
+}
+
+void free_on_node(void* mem, size_t size, int node)
+{
+#ifdef LOGGER_NUMA
+    if (node >= 0 && numa_available() >= 0) {
+        numa_free(mem, size);
+        return;
+    }
+#else
+    (void)size;
+    (void)node;
+#endif
+    ::operator delete(mem);
+}
@@ -0,0 +1,62 @@
+#pragma once
+/*
+ * cpu_topology.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstddef>
+#include <vector>
+
+#include <pthread.h>
+
+/**
+ * @brief Helpers used to place the logger daemons (see
+ * @brief logger::set_cpu_affinity, set_numa_node and set_numa_backends).
+ * @brief When built with LOGGER_NUMA (make NUMA=1) libnuma is used,
+ * @brief otherwise the topology is read from /sys/devices/system/node
+ * @brief and the memory placement rely on the kernel first touch policy,
+ * @brief i.e. memory is allocated on the node of the pinned thread.
+ */
+
+/** @brief numa_node_count()
+ *  @return count of NUMA nodes, 1 if unknown or not NUMA
+ */
+int numa_node_count();
+
+/** @brief numa_node_cpus()
+ *  @return cpus of the node, empty if the node doesn't exist
+ */
+std::vector<int> numa_node_cpus(int node);
+
+/** @brief current_numa_node()
+ *  @return node of the cpu running the calling thread, 0 if unknown
+ */
+int current_numa_node();
+
+/** @brief pin_thread() set the cpu affinity of a thread
+ *  @return false if cpus is empty or invalid
+ */
+bool pin_thread(pthread_t thread, const std::vector<int>& cpus);
+
+/** @brief prefer_numa_node() the next allocations of the calling thread
+ *  @brief are done on this node. No-op without libnuma
+ */
+void prefer_numa_node(int node);
+
+/** @brief alloc_on_node() allocate size bytes on a node (numa_alloc_onnode),
+ *  @brief or with operator new if node is -1 or without libnuma (first
+ *  @brief touch then). Freed by free_on_node with the same size and node
+ */
+void* alloc_on_node(size_t size, int node);
+void free_on_node(void* mem, size_t size, int node);
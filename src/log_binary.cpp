@@ -0,0 +1,69 @@
+/*
+ * log_binary.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "log_binary.hpp"
+
+bool log_binary_reader::open(const std::string& filename) {
+    log_binary_entry entry;
+
+    _file.open(filename, std::ios_base::binary);
+    if (!_file.read(reinterpret_cast<char*>(&entry), sizeof(entry)) ||
+            entry.type != (uint8_t)log_binary_type::session ||
+            entry.string_id != LOG_BINARY_MAGIC ||
+            entry.literal_offset != LOG_BINARY_VERSION)
+        return false;
+    _file.seekg(0);
+    return true;
+}
+
+bool log_binary_reader::next(log_binary_line& line) {
+    log_binary_entry entry;
+    std::string text;
+
+    while (_file.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+        text.resize(entry.length);
+        if (!_file.read(&text[0], entry.length))
+            return false;
+
+        switch ((log_binary_type)entry.type) {
+        case log_binary_type::session:
+            _strings.clear();
+            break;
+        case log_binary_type::string:
+            if (entry.string_id != _strings.size() + 1)
+                return false;       // the table is written in order
+            _strings.push_back(std::move(text));
+            _string_bytes += sizeof(entry) + entry.length;
+            break;
+        case log_binary_type::line:
+            line.level = entry.level;
+            line.time_ns = entry.time_ns;
+            line.sequence = entry.sequence;
+            line.string_id = entry.string_id;
+            line.text = std::move(text);
+            if (entry.string_id > 0 && entry.string_id <= _strings.size()) {
+                const std::string& literal = _strings[entry.string_id - 1];
+                line.text.insert(std::min<size_t>(entry.literal_offset,
+                                                  line.text.size()), literal);
+                _literal_bytes += literal.size();
+            }
+            return true;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
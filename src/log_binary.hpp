@@ -0,0 +1,103 @@
+#pragma once
+/*
+ * log_binary.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Binary log file, written by binary_file_log_policy and read
+ * @brief by the log_decode tool. The file is a sequence of entries,
+ * @brief each one followed by length bytes of text:
+ * @brief - session: written each time the file is opened, the string
+ * @brief   table restart (string_id is LOG_BINARY_MAGIC, literal_offset
+ * @brief   the version)
+ * @brief - string: a literal message, string_id is its id in the table
+ * @brief - line: a line without its literal (if string_id is not 0),
+ * @brief   which belong at literal_offset in the text
+ * @brief A constant message is then written once per session, whatever
+ * @brief the count of lines logging it.
+ */
+#define LOG_BINARY_MAGIC     0x4E494247     // "GBIN"
+#define LOG_BINARY_VERSION   1
+
+enum class log_binary_type : uint8_t
+{
+    session = 1,
+    string,
+    line
+};
+
+struct log_binary_entry
+{
+    uint8_t type;               // log_binary_type
+    uint8_t level;              // log_level of a line
+    uint16_t reserved;
+    uint32_t string_id;
+    uint32_t literal_offset;
+    uint32_t length;            // bytes of text after the entry
+    int64_t time_ns;            // wall clock, ns since the epoch
+    uint64_t sequence;          // line number (%i), 0 if unknown
+};
+
+/**
+ * @brief log_binary_line is a line read by log_binary_reader, with
+ * @brief its literal inserted
+ */
+struct log_binary_line
+{
+    uint8_t level;
+    int64_t time_ns;
+    uint64_t sequence;
+    uint32_t string_id;
+    std::string text;
+};
+
+/**
+ * @brief log_binary_reader read the lines of a binary log file
+ */
+class log_binary_reader
+{
+public:
+    /** @brief open()
+     *  @return false if the file can't be read or is not a binary log
+     */
+    bool open(const std::string& filename);
+
+    /** @brief next() read the next line
+     *  @return false at the end of the file (or on a truncated entry)
+     */
+    bool next(log_binary_line& line);
+
+    /** @brief strings() the string table of the current session,
+     *  @brief string id n is strings()[n - 1]
+     */
+    const std::vector<std::string>& strings() const { return _strings; }
+
+    /** @brief string_bytes() bytes of the string entries read,
+     *  @brief literal_bytes() bytes of the literals they stand for
+     */
+    uint64_t string_bytes() const { return _string_bytes; }
+    uint64_t literal_bytes() const { return _literal_bytes; }
+
+private:
+    std::ifstream _file;
+    std::vector<std::string> _strings;
+    uint64_t _string_bytes = 0;
+    uint64_t _literal_bytes = 0;
+};
@@ -0,0 +1,121 @@
+/*
+ * log_clock.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "log_clock.hpp"
+
+#ifdef LOG_CLOCK_HAS_TSC
+#include <cpuid.h>
+#endif
+
+/* The first calibration measure the tick period on this spin at least */
+#define LOG_CLOCK_FIRST_SPIN_NS 1000000
+
+static bool detect_tsc()
+{
+#ifdef LOG_CLOCK_HAS_TSC
+    unsigned int eax, ebx, ecx, edx;
+
+    // Invariant TSC: constant rate, synchronized between the cores
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        return edx & (1 << 8);
+#endif
+    return false;
+}
+
+static int64_t clock_ns(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Defined in this order, the statics are initialized in this order
+const bool log_clock::_tsc = detect_tsc();
+std::atomic<uint32_t> log_clock::_seq(0);
+std::atomic<uint64_t> log_clock::_base_ticks(0);
+std::atomic<int64_t> log_clock::_base_ns(0);
+std::atomic<double> log_clock::_ns_per_tick(1.0);
+uint64_t log_clock::_first_ticks = log_clock::now();
+int64_t log_clock::_first_mono_ns = clock_ns(CLOCK_MONOTONIC_RAW);
+std::atomic<int64_t> log_clock::_last_calibration(INT64_MIN);
+
+static struct log_clock_init {
+    log_clock_init() { log_clock::calibrate(); }
+} first_calibration;
+
+int64_t log_clock::to_realtime_ns(uint64_t ticks)
+{
+    uint32_t seq;
+    uint64_t base_ticks;
+    int64_t base_ns;
+    double ns_per_tick;
+
+    do {
+        seq = _seq.load(std::memory_order_acquire);
+        base_ticks = _base_ticks.load(std::memory_order_acquire);
+        base_ns = _base_ns.load(std::memory_order_acquire);
+        ns_per_tick = _ns_per_tick.load(std::memory_order_acquire);
+    } while ((seq & 1) || seq != _seq.load(std::memory_order_acquire));
+
+    // ticks may be a bit older than the base
+    return base_ns + (int64_t)((double)(int64_t)(ticks - base_ticks) * ns_per_tick);
+}
+
+void log_clock::calibrate()
+{
+    int64_t now = clock_ns(CLOCK_MONOTONIC_COARSE);
+    int64_t last = _last_calibration.load(std::memory_order_relaxed);
+
+    if (last != INT64_MIN && now - last < (int64_t)LOG_CLOCK_CALIBRATE_MS * 1000000)
+        return;
+    // Only one thread recalibrate
+    if (!_last_calibration.compare_exchange_strong(last, now))
+        return;
+    recalibrate();
+}
+
+void log_clock::recalibrate()
+{
+    uint64_t ticks;
+    int64_t real_ns;
+    double ns_per_tick = 1.0;
+
+    if (_tsc) {
+        // The period is measured since the first sample, on the raw
+        // monotonic clock, so it get more precise with time
+        int64_t mono_ns;
+        do {
+            uint64_t before = now();
+            real_ns = clock_ns(CLOCK_REALTIME);
+            mono_ns = clock_ns(CLOCK_MONOTONIC_RAW);
+            ticks = before + (now() - before) / 2;
+        } while (mono_ns - _first_mono_ns < LOG_CLOCK_FIRST_SPIN_NS);
+
+        ns_per_tick = (double)(mono_ns - _first_mono_ns) /
+                      (double)(ticks - _first_ticks);
+    } else {
+        // Same resolution for both, the offset follow the wall clock
+        ticks = now();
+        real_ns = clock_ns(CLOCK_REALTIME_COARSE);
+    }
+
+    uint32_t seq = _seq.load(std::memory_order_relaxed);
+    _seq.store(seq + 1, std::memory_order_release);
+    _base_ticks.store(ticks, std::memory_order_release);
+    _base_ns.store(real_ns, std::memory_order_release);
+    _ns_per_tick.store(ns_per_tick, std::memory_order_release);
+    _seq.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,102 @@
+#pragma once
+/*
+ * log_clock.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <atomic>
+#include <cstdint>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LOG_CLOCK_HAS_TSC
+#endif
+
+/**
+ * @brief LOG_CLOCK_CALIBRATE_MS period of the recalibration, done by
+ * @brief the logger thread (see log_clock::calibrate)
+ */
+#define LOG_CLOCK_CALIBRATE_MS 1000
+
+/**
+ * @brief log_clock is the time base of the lines. The producer only
+ * @brief read a raw tick counter: the TSC when it is invariant (x86),
+ * @brief otherwise CLOCK_MONOTONIC_COARSE in ns (vDSO, no syscall, but
+ * @brief its resolution is the kernel tick, a few ms).
+ * @brief Ticks are converted to wall clock with the last calibration
+ * @brief (a base tick, its wall clock time, and the tick period),
+ * @brief which is refreshed by the logger thread so that it follows
+ * @brief the drift of the TSC and the changes of the wall clock.
+ */
+class log_clock
+{
+public:
+    /** @brief now() the raw ticks, to be converted by to_realtime_ns
+     */
+    static uint64_t now() {
+#ifdef LOG_CLOCK_HAS_TSC
+        if (_tsc)
+            return __rdtsc();
+#endif
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    /** @brief to_realtime_ns() convert ticks to ns since the epoch
+     */
+    static int64_t to_realtime_ns(uint64_t ticks);
+
+    /** @brief duration_ns() convert a difference of ticks to ns
+     */
+    static uint64_t duration_ns(uint64_t ticks) {
+        return (uint64_t)((double)ticks *
+                          _ns_per_tick.load(std::memory_order_relaxed));
+    }
+
+    /** @brief calibrate() refresh the calibration if it is older
+     *  @brief than LOG_CLOCK_CALIBRATE_MS. Cheap otherwise, and safe
+     *  @brief to be called by several threads
+     */
+    static void calibrate();
+
+    /** @brief is_tsc()
+     *  @return true if the ticks are from the TSC
+     */
+    static bool is_tsc() { return _tsc; }
+
+private:
+    /** @brief recalibrate() compute and publish a new calibration
+     */
+    static void recalibrate();
+
+    static const bool _tsc;
+
+    /** @brief the calibration, published with a seqlock (_seq is odd
+     *  @brief while it is written)
+     */
+    static std::atomic<uint32_t> _seq;
+    static std::atomic<uint64_t> _base_ticks;
+    static std::atomic<int64_t> _base_ns;
+    static std::atomic<double> _ns_per_tick;
+
+    /** @brief first sample, the tick period is measured since it
+     *  @brief _last_calibration monotonic ns of the last calibration
+     */
+    static uint64_t _first_ticks;
+    static int64_t _first_mono_ns;
+    static std::atomic<int64_t> _last_calibration;
+};
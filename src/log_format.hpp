@@ -0,0 +1,655 @@
+#pragma once
+/*
+ * log_format.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <charconv>
+#include <cmath>
+#include <type_traits>
+
+/**
+ * @brief output_format of a logger
+ * @param text header built with the user pattern, then the message
+ * @param json one JSON object per line, typed fields are kept
+ */
+enum class output_format
+{
+    text = 1,
+    json
+};
+
+/**
+ * @brief log_formatter<T> append the text of a value to a log line.
+ * @brief This is the extension point for user types, no need to
+ * @brief define operator<<, just specialize the struct:
+ * @brief   template<> struct log_formatter<my_type> {
+ * @brief       static void format(std::string& out, const my_type& v);
+ * @brief   };
+ * @brief The default implementation fall back to operator<<
+ */
+template< typename T, typename Enable = void >
+struct log_formatter
+{
+    static void format(std::string& out, const T& value) {
+        std::ostringstream oss;
+        oss << value;
+        out.append(oss.str());
+    }
+};
+
+/** @brief log_append() append value to out using its log_formatter
+ */
+template< typename T >
+inline void log_append(std::string& out, const T& value)
+{
+    log_formatter< std::decay_t<T> >::format(out, value);
+}
+
+/** @brief integers (and bool, printed as 0 / 1 like iostreams)
+ *  @brief are written by std::to_chars
+ */
+template< typename T >
+struct log_formatter< T, std::enable_if_t< std::is_integral<T>::value &&
+        !std::is_same<T, char>::value && !std::is_same<T, signed char>::value
+        && !std::is_same<T, unsigned char>::value > >
+{
+    static void format(std::string& out, T value) {
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf),
+                std::conditional_t< std::is_same<T, bool>::value, int, T >(value));
+        out.append(buf, res.ptr - buf);
+    }
+};
+
+/** @brief chars are written as characters, like iostreams
+ */
+template< typename T >
+struct log_formatter< T, std::enable_if_t< std::is_same<T, char>::value ||
+        std::is_same<T, signed char>::value ||
+        std::is_same<T, unsigned char>::value > >
+{
+    static void format(std::string& out, T value) {
+        out.push_back(static_cast<char>(value));
+    }
+};
+
+/** @brief floating points are written with the shortest representation
+ *  @brief that roundtrip (std::to_chars), i.e. 0.1 is written "0.1"
+ */
+template< typename T >
+struct log_formatter< T, std::enable_if_t< std::is_floating_point<T>::value > >
+{
+    static void format(std::string& out, T value) {
+        char buf[64];
+        auto res = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, res.ptr - buf);
+    }
+};
+
+/** @brief string like args are copied directly
+ */
+template<>
+struct log_formatter< const char* >
+{
+    static void format(std::string& out, const char* value) {
+        if (value)
+            out.append(value);
+    }
+};
+
+template<>
+struct log_formatter< char* >
+{
+    static void format(std::string& out, const char* value) {
+        log_formatter< const char* >::format(out, value);
+    }
+};
+
+template<>
+struct log_formatter< std::string >
+{
+    static void format(std::string& out, const std::string& value) {
+        out.append(value);
+    }
+};
+
+template<>
+struct log_formatter< std::string_view >
+{
+    static void format(std::string& out, std::string_view value) {
+        out.append(value);
+    }
+};
+
+/**
+ * @brief log_kv is a typed key/value field of a structured message
+ * @brief it is built by the kv() function:
+ * @brief logger->LOG_INFO("request done", kv("user", id), kv("us", t));
+ * @brief key shall be a string literal (only the pointer is kept)
+ */
+template< typename T >
+struct log_kv
+{
+    const char* key;
+    T value;
+};
+
+template< typename T >
+log_kv< std::decay_t<T> > kv(const char* key, T&& value)
+{
+    return log_kv< std::decay_t<T> >{ key, std::forward<T>(value) };
+}
+
+template< typename T >
+struct is_log_kv : std::false_type { };
+
+template< typename T >
+struct is_log_kv< log_kv<T> > : std::true_type { };
+
+/** @brief text output of a field: " key=value"
+ */
+template< typename T >
+struct log_formatter< log_kv<T> >
+{
+    static void format(std::string& out, const log_kv<T>& field) {
+        out.push_back(' ');
+        out.append(field.key);
+        out.push_back('=');
+        log_append(out, field.value);
+    }
+};
+
+template< typename T >
+std::ostream& operator<<(std::ostream& os, const log_kv<T>& field)
+{
+    return os << ' ' << field.key << '=' << field.value;
+}
+
+/**
+ * @brief LOG_FMT wrap a format string literal, to be used as first
+ * @brief arg of print, i.e.
+ * @brief logger->LOG_INFO(LOG_FMT("{} took {} us"), name, t);
+ * @brief Replacement fields are "{}" or "{:spec}", spec being an
+ * @brief optional precision ".N" followed by an optional type:
+ * @brief   d x X o b c : integers (decimal, hexa, octal, binary, char)
+ * @brief   f e g       : floating points (fixed, scientific, general)
+ * @brief   s           : strings
+ * @brief "{{" and "}}" are literal braces. The string is parsed at
+ * @brief compile time, and the count and types of the args are checked
+ * @brief against it (static_assert). Only the parsed layout is used
+ * @brief at runtime.
+ * @brief It is a macro as C++17 can't take a string literal as
+ * @brief a template parameter, each expansion create its own type.
+ */
+#define LOG_FMT(str) ([]() {                                        \
+            struct log_fmt_str {                                    \
+                static constexpr std::string_view value() {         \
+                    return str; }                                   \
+            };                                                      \
+            return log_fmt< log_fmt_str >(); }())
+
+/** @brief log_fmt_segment is a piece of a parsed format string:
+ *  @brief the literal text, followed by a replacement field if has_arg
+ */
+struct log_fmt_segment
+{
+    size_t literal_pos;
+    size_t literal_len;
+    bool has_arg;
+    char type;          // 0 if not set in the spec
+    int precision;      // -1 if not set in the spec
+};
+
+enum class log_fmt_error
+{
+    none,
+    open_brace,     // '{' without matching '}'
+    close_brace,    // '}' alone
+    bad_spec        // unknown type or malformed precision
+};
+
+/** @brief log_fmt_layout is the result of the compile time parsing
+ */
+template< size_t N >
+struct log_fmt_layout
+{
+    log_fmt_segment segments[N];
+    size_t count;       // segments used
+    size_t arg_count;   // replacement fields
+    log_fmt_error error;
+};
+
+/** @brief log_fmt_capacity() upper bound of segments count
+ */
+constexpr size_t log_fmt_capacity(std::string_view str)
+{
+    size_t count = 1;
+    for (char c : str)
+        if (c == '{' || c == '}')
+            count++;
+    return count;
+}
+
+template< size_t N >
+constexpr log_fmt_layout<N> log_fmt_parse(std::string_view str)
+{
+    log_fmt_layout<N> layout{};
+    size_t literal_pos = 0;
+    size_t i = 0;
+
+    auto push = [&layout](size_t pos, size_t len, bool has_arg,
+                                char type, int precision) {
+        layout.segments[layout.count] = { pos, len, has_arg, type, precision };
+        layout.count++;
+        if (has_arg)
+            layout.arg_count++;
+    };
+
+    while (i < str.size()) {
+        if (str[i] == '}') {
+            if (i + 1 >= str.size() || str[i + 1] != '}') {
+                layout.error = log_fmt_error::close_brace;
+                return layout;
+            }
+            push(literal_pos, i + 1 - literal_pos, false, 0, -1); // keep one
+            i += 2;
+            literal_pos = i;
+        } else if (str[i] == '{') {
+            if (i + 1 < str.size() && str[i + 1] == '{') {
+                push(literal_pos, i + 1 - literal_pos, false, 0, -1);
+                i += 2;
+                literal_pos = i;
+                continue;
+            }
+            size_t literal_len = i - literal_pos;
+            char type = 0;
+            int precision = -1;
+            i++;
+            if (i < str.size() && str[i] == ':') {
+                i++;
+                if (i < str.size() && str[i] == '.') {
+                    precision = 0;
+                    for (i++; i < str.size() && str[i] >= '0' && str[i] <= '9'
+                                    && precision < 100; i++)
+                        precision = precision * 10 + (str[i] - '0');
+                    if (precision >= 100 || str[i - 1] == '.') {
+                        layout.error = log_fmt_error::bad_spec;
+                        return layout;
+                    }
+                }
+                if (i < str.size() && str[i] != '}') {
+                    type = str[i];
+                    i++;
+                    switch (type) {
+                    case 'd': case 'x': case 'X': case 'o': case 'b': case 'c':
+                    case 'f': case 'e': case 'g': case 's':
+                        break;
+                    default:
+                        layout.error = log_fmt_error::bad_spec;
+                        return layout;
+                    }
+                }
+            }
+            if (i >= str.size()) {
+                layout.error = log_fmt_error::open_brace;
+                return layout;
+            }
+            if (str[i] != '}') {
+                layout.error = log_fmt_error::bad_spec;
+                return layout;
+            }
+            push(literal_pos, literal_len, true, type, precision);
+            i++;
+            literal_pos = i;
+        } else
+            i++;
+    }
+    if (literal_pos < str.size())
+        push(literal_pos, str.size() - literal_pos, false, 0, -1);
+
+    return layout;
+}
+
+/** @brief log_fmt_category() kind of an arg, regarding the spec type
+ */
+template< typename T >
+constexpr char log_fmt_category()
+{
+    if constexpr (std::is_same<T, bool>::value)
+        return 'b';
+    else if constexpr (std::is_same<T, char>::value ||
+            std::is_same<T, signed char>::value ||
+            std::is_same<T, unsigned char>::value)
+        return 'c';
+    else if constexpr (std::is_integral<T>::value)
+        return 'i';
+    else if constexpr (std::is_floating_point<T>::value)
+        return 'f';
+    else if constexpr (std::is_convertible<const T&, std::string_view>::value)
+        return 's';
+    else
+        return 'o';
+}
+
+/** @brief log_fmt_accept() check that an arg category match the spec
+ */
+constexpr bool log_fmt_accept(const log_fmt_segment& seg, char category)
+{
+    switch (seg.type) {
+    case 0:
+        return seg.precision < 0 || category == 'f';
+    case 'd': case 'x': case 'X': case 'o': case 'b':
+        return (category == 'i' || category == 'c' || category == 'b')
+                    && seg.precision < 0;
+    case 'c':
+        return (category == 'i' || category == 'c') && seg.precision < 0;
+    case 'f': case 'e': case 'g':
+        return category == 'f';
+    case 's':
+        return (category == 's' || category == 'b') && seg.precision < 0;
+    }
+    return false;
+}
+
+/** @brief log_fmt_append() append one arg according to its spec
+ */
+template< typename T >
+void log_fmt_append(std::string& out, const T& value,
+                                const log_fmt_segment& seg)
+{
+    if constexpr (std::is_integral<T>::value) {
+        int base = 10;
+        switch (seg.type) {
+        case 'x': case 'X': base = 16; break;
+        case 'o': base = 8; break;
+        case 'b': base = 2; break;
+        case 'c':
+            out.push_back(static_cast<char>(value));
+            return;
+        case 'd':
+            break;
+        case 's':   // only for bool
+            out.append(value ? "true" : "false");
+            return;
+        default:
+            log_append(out, value);
+            return;
+        }
+        char buf[72];
+        auto res = std::to_chars(buf, buf + sizeof(buf),
+                std::conditional_t< std::is_same<T, bool>::value, int,
+                        std::conditional_t< sizeof(T) == 1,
+                        std::conditional_t< std::is_signed<T>::value, int,
+                                        unsigned int >, T > >(value), base);
+        if (seg.type == 'X')
+            for (char* c = buf; c < res.ptr; ++c)
+                if (*c >= 'a' && *c <= 'f')
+                    *c -= 'a' - 'A';
+        out.append(buf, res.ptr - buf);
+    } else if constexpr (std::is_floating_point<T>::value) {
+        if (seg.type == 0 && seg.precision < 0) {
+            log_append(out, value);
+            return;
+        }
+        std::chars_format fmt = seg.type == 'f' ? std::chars_format::fixed :
+                                seg.type == 'e' ? std::chars_format::scientific :
+                                                  std::chars_format::general;
+        char buf[512];  // enough for any double in fixed, precision < 100
+        auto res = seg.precision < 0 ?
+                std::to_chars(buf, buf + sizeof(buf), value, fmt) :
+                std::to_chars(buf, buf + sizeof(buf), value, fmt, seg.precision);
+        if (res.ec == std::errc())
+            out.append(buf, res.ptr - buf);
+        else
+            log_append(out, value);
+    } else
+        log_append(out, value);
+}
+
+/**
+ * @brief log_fmt<S> a format string parsed at compile time
+ * @brief S is the type built by the LOG_FMT macro
+ */
+template< typename S >
+struct log_fmt
+{
+    static constexpr std::string_view str = S::value();
+    static constexpr size_t capacity = log_fmt_capacity(str);
+    static constexpr log_fmt_layout<capacity> layout =
+                                            log_fmt_parse<capacity>(str);
+
+    static_assert(layout.error != log_fmt_error::open_brace,
+            "LOG_FMT: '{' without matching '}' in format string");
+    static_assert(layout.error != log_fmt_error::close_brace,
+            "LOG_FMT: single '}' in format string, use '}}'");
+    static_assert(layout.error != log_fmt_error::bad_spec,
+            "LOG_FMT: invalid format spec, expected {:[.N][dxXobcfegs]}");
+
+    /** @brief check() compile time check of the args
+     */
+    template< typename...Args >
+    static constexpr bool check() {
+        constexpr char categories[] = { log_fmt_category<Args>()..., 0 };
+        size_t arg = 0;
+        for (size_t i = 0; i < layout.count; ++i)
+            if (layout.segments[i].has_arg)
+                if (!log_fmt_accept(layout.segments[i], categories[arg++]))
+                    return false;
+        return true;
+    }
+
+    /** @brief format_to() append the formatted message to out
+     */
+    template< typename...Args >
+    void format_to(std::string& out, const Args&...args) const {
+        static_assert(sizeof...(Args) == layout.arg_count,
+                "LOG_FMT: args count doesn't match the format string");
+        static_assert(check< std::decay_t<Args>... >(),
+                "LOG_FMT: args type doesn't match the format spec");
+
+        size_t seg = 0;
+        auto append_literal = [&out](const log_fmt_segment& segment) {
+            out.append(str.data() + segment.literal_pos, segment.literal_len);
+        };
+        auto append_arg = [&](const auto& arg) {
+            while (!layout.segments[seg].has_arg)  // escaped braces
+                append_literal(layout.segments[seg++]);
+            append_literal(layout.segments[seg]);
+            log_fmt_append(out, arg, layout.segments[seg]);
+            seg++;
+        };
+        (append_arg(args), ...);
+        for (; seg < layout.count; ++seg)   // trailing text
+            append_literal(layout.segments[seg]);
+    }
+};
+
+template< typename T >
+struct is_log_fmt : std::false_type { };
+
+template< typename S >
+struct is_log_fmt< log_fmt<S> > : std::true_type { };
+
+/** @brief log_append_message() append the message part of a line:
+ *  @brief args concatenated, or formatted if the first one is a LOG_FMT
+ */
+template< typename...Args >
+void log_append_message(std::string& out, const Args&...args)
+{
+    (log_append(out, args), ...);
+}
+
+template< typename S, typename...Args >
+void log_append_message(std::string& out, const log_fmt<S>& fmt,
+                                    const Args&...args)
+{
+    fmt.format_to(out, args...);
+}
+
+/** @brief is_log_literal<T> true for a const char array, the type of
+ *  @brief a string literal. Other arrays of this type exist (const
+ *  @brief members, locals), so log_static_storage is checked as well
+ */
+template< typename T >
+struct is_log_literal : std::false_type { };
+
+template< size_t N >
+struct is_log_literal< const char[N] > : std::true_type { };
+
+template< typename...Args >
+struct log_first_literal : std::false_type { };
+
+template< typename First, typename...Args >
+struct log_first_literal< First, Args... > :
+        is_log_literal< std::remove_reference_t<First> > { };
+
+// Set by the linker: start of the executable and end of its data,
+// string literals and const globals are between them
+extern "C" const char __executable_start[];
+extern "C" const char _edata[];
+
+/** @brief log_static_storage() true if text is in the data of the
+ *  @brief executable (not the stack, the heap or a shared library),
+ *  @brief so it is valid and unchanged until exit
+ */
+inline bool log_static_storage(const char* text)
+{
+    return text >= __executable_start && text < _edata;
+}
+
+/**
+ * @brief json_writer append JSON tokens to a string
+ * @brief no iostreams and no temporary object, the only allocation
+ * @brief is the growth of the output string (which could be reserved)
+ */
+class json_writer
+{
+public:
+    json_writer(std::string& out): _out(out) { }
+
+    /** @brief key() append "key": (with a leading comma if required)
+     */
+    void key(std::string_view name, bool first = false) {
+        if (!first)
+            _out.push_back(',');
+        string(name);
+        _out.push_back(':');
+    }
+
+    /** @brief string() append a quoted and escaped string
+     */
+    void string(std::string_view str) {
+        _out.push_back('"');
+        escaped(str);
+        _out.push_back('"');
+    }
+
+    /** @brief escaped() append str escaped, without quotes
+     */
+    void escaped(std::string_view str) {
+        static const char hex[] = "0123456789abcdef";
+        const char* run = str.data();  // chars that don't need escaping
+        const char* end = str.data() + str.size();
+
+        for (const char* it = run; it < end; ++it) {
+            unsigned char c = static_cast<unsigned char>(*it);
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            _out.append(run, it - run);
+            run = it + 1;
+            _out.push_back('\\');
+            switch (c) {
+            case '"':  _out.push_back('"');  break;
+            case '\\': _out.push_back('\\'); break;
+            case '\n': _out.push_back('n');  break;
+            case '\r': _out.push_back('r');  break;
+            case '\t': _out.push_back('t');  break;
+            case '\b': _out.push_back('b');  break;
+            case '\f': _out.push_back('f');  break;
+            default:
+                _out.append("u00");
+                _out.push_back(hex[c >> 4]);
+                _out.push_back(hex[c & 0x0F]);
+            }
+        }
+        _out.append(run, end - run);
+    }
+
+    /** @brief value() overloads, the JSON type follow the C++ type
+     */
+    void value(bool b) { _out.append(b ? "true" : "false"); }
+    void value(char c) { string(std::string_view(&c, 1)); }
+    void value(const char* str) { string(str ? str : ""); }
+    void value(const std::string& str) { string(str); }
+    void value(std::string_view str) { string(str); }
+
+    template< typename T >
+    std::enable_if_t< std::is_integral<T>::value > value(T n) {
+        log_append(_out, n);
+    }
+
+    template< typename T >
+    std::enable_if_t< std::is_floating_point<T>::value > value(T f) {
+        if (!std::isfinite(f)) {  // not representable in JSON
+            _out.append("null");
+            return;
+        }
+        log_append(_out, f);
+    }
+
+    /** @brief any other type is formatted by its log_formatter
+     *  @brief and stored as a string
+     */
+    template< typename T >
+    std::enable_if_t< !std::is_arithmetic<T>::value &&
+            !std::is_convertible<const T&, std::string_view>::value >
+    value(const T& other) {
+        size_t start = _out.size();
+        _out.push_back('"');
+        log_append(_out, other);
+        escape_from(start + 1);
+        _out.push_back('"');
+    }
+
+    /** @brief escape_from() escape in place the tail of the output,
+     *  @brief from pos to the end. Used when a value has been appended
+     *  @brief by a log_formatter, to avoid a temporary string
+     */
+    void escape_from(size_t pos) {
+        size_t count = 0;
+        for (size_t i = pos; i < _out.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(_out[i]);
+            if (c < 0x20 || c == '"' || c == '\\')
+                count++;
+        }
+        if (count == 0)
+            return;     // nothing to escape, most common case
+
+        std::string tail(_out, pos);
+        _out.resize(pos);
+        escaped(tail);
+    }
+
+    /** @brief raw() append without any escaping
+     */
+    void raw(std::string_view str) { _out.append(str); }
+    void raw(char c) { _out.push_back(c); }
+
+private:
+    std::string& _out;
+};
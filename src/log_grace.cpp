@@ -0,0 +1,50 @@
+/*
+ * log_grace.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "log_grace.hpp"
+
+#include <thread>
+
+unsigned int log_grace::stripe()
+{
+    static std::atomic<unsigned int> next_stripe(0);
+    static thread_local unsigned int stripe =
+                    next_stripe.fetch_add(1, std::memory_order_relaxed) %
+                                                        LOG_GRACE_STRIPES;
+    return stripe;
+}
+
+void log_grace::wait_readers(unsigned int phase)
+{
+    for (auto& counter : _counters[phase])
+        while (counter.count.load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+}
+
+/* A reader may have read the phase before the flip and increment its
+ * counter after the writer has seen it at 0: it hold the new object
+ * then, but it is waited for by the next flip, of the next call */
+void log_grace::synchronize()
+{
+    std::scoped_lock<std::mutex> lock(_sync_mutex);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int flip = 0; flip < 2; flip++) {
+        unsigned int phase = _phase.load();
+        _phase.store(phase ^ 1);
+        wait_readers(phase);
+    }
+}
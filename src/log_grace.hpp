@@ -0,0 +1,95 @@
+#pragma once
+/*
+ * log_grace.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @brief LOG_GRACE_STRIPES count of reader counters of each phase, a
+ * @brief thread always use the same one, so that the producers of
+ * @brief different threads rarely share a cache line
+ */
+#define LOG_GRACE_STRIPES 16
+
+/**
+ * @brief log_grace let the producers read an object published in an
+ * @brief atomic pointer without lock, and the writer free the previous
+ * @brief one once they are done with it (a grace period, like RCU):
+ * @brief      reader: log_grace::reader guard(grace);  ptr = p.load(); ...
+ * @brief      writer: old = p.exchange(next); grace.synchronize(); delete old;
+ * @brief A reader only increment then decrement a counter of its stripe.
+ * @brief synchronize() wait for the readers entered before the call,
+ * @brief with two phases so that a reader late to increment its counter
+ * @brief is still waited for. It shall not be called by a reader
+ */
+class log_grace
+{
+public:
+    log_grace() : _phase(0) { }
+
+    log_grace(const log_grace&) = delete;
+    log_grace& operator=(const log_grace&) = delete;
+
+    /** @brief reader guard, the section last its lifetime. Readers
+     *  @brief may be nested
+     */
+    class reader
+    {
+    public:
+        explicit reader(log_grace& grace) : _counter(grace.enter()) { }
+        ~reader() { _counter->fetch_sub(1, std::memory_order_release); }
+
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+    private:
+        std::atomic<uint64_t>* _counter;
+    };
+
+    /** @brief synchronize() return once every reader section started
+     *  @brief before the call is ended
+     */
+    void synchronize();
+
+private:
+    std::atomic<uint64_t>* enter() {
+        unsigned int phase = _phase.load();
+        std::atomic<uint64_t>* counter = &_counters[phase][stripe()].count;
+        counter->fetch_add(1);
+        return counter;
+    }
+
+    /** @brief stripe() of the calling thread, given round robin
+     */
+    static unsigned int stripe();
+
+    /** @brief wait_readers() until the counters of phase are all 0
+     */
+    void wait_readers(unsigned int phase);
+
+    struct alignas(64) stripe_counter
+    {
+        std::atomic<uint64_t> count{0};
+    };
+
+    std::atomic<unsigned int> _phase;
+    stripe_counter _counters[2][LOG_GRACE_STRIPES];
+
+    /** @brief _sync_mutex serialize the writers
+     */
+    std::mutex _sync_mutex;
+};
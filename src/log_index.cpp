@@ -0,0 +1,139 @@
+/*
+ * log_index.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "log_index.hpp"
+#include "log_clock.hpp"
+
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+log_index_writer::log_index_writer(): _interval(LOG_INDEX_INTERVAL),
+                                      _in_block(false) { }
+
+log_index_writer::~log_index_writer() {
+    close();
+}
+
+bool log_index_writer::open(const std::string& filename, bool truncate,
+                                                        uint64_t interval) {
+    std::string index_name = filename + LOG_INDEX_SUFFIX;
+    log_index_header header;
+    std::vector<log_index_entry> entries;
+
+    close();
+    _interval = interval;
+
+    // Append to a valid index of the same interval, restart otherwise
+    if (!truncate && (!log_index_read(filename, header, entries) ||
+                                        header.interval != interval))
+        truncate = true;
+
+    // Remove an entry partially written (crash), so that the next ones are aligned
+    if (!truncate) {
+        std::error_code error;
+        fs::resize_file(index_name, sizeof(header) +
+                        entries.size() * sizeof(log_index_entry), error);
+    }
+
+    _file.open(index_name, std::ios_base::binary | std::ios_base::out |
+                    (truncate ? std::ios_base::trunc : std::ios_base::app));
+    if (!_file.is_open())
+        return false;
+
+    if (truncate) {
+        header = { LOG_INDEX_MAGIC, LOG_INDEX_VERSION, interval };
+        _file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        _file.flush();
+    }
+    return true;
+}
+
+void log_index_writer::close() {
+    if (_file.is_open()) {
+        end_block();
+        _file.close();
+    }
+}
+
+void log_index_writer::add(const log_record_view& record, uint64_t offset,
+                                                        size_t length) {
+    if (!_file.is_open())
+        return;
+
+    int64_t ns = record.timestamp ? log_clock::to_realtime_ns(record.timestamp) :
+                                    log_clock::to_realtime_ns(log_clock::now());
+
+    // A gap (lines written without index) start a new block
+    if (_in_block && offset != _block.offset + _block.length)
+        end_block();
+
+    if (!_in_block) {
+        memset(&_block, 0, sizeof(_block));
+        _block.offset = offset;
+        _block.min_ns = ns;
+        _block.max_ns = ns;
+        _in_block = true;
+    }
+
+    // Lines of different threads reach the file slightly out of order
+    _block.length += length;
+    if (ns < _block.min_ns)
+        _block.min_ns = ns;
+    if (ns > _block.max_ns)
+        _block.max_ns = ns;
+    if (record.sequence && (!_block.min_sequence ||
+                            record.sequence < _block.min_sequence))
+        _block.min_sequence = record.sequence;
+    int level = (int)record.level - (int)log_level::debug;
+    if (level >= 0 && level < LOG_INDEX_LEVELS)
+        _block.level_count[level]++;
+
+    if (_block.length >= _interval)
+        end_block();
+}
+
+void log_index_writer::add(uint64_t offset, size_t length) {
+    add(log_record{ log_level::info, std::string() }, offset, length);
+}
+
+/* One entry per block, written at once: the reader ignore
+ * an incomplete entry at the end */
+void log_index_writer::end_block() {
+    if (!_in_block)
+        return;
+
+    _file.write(reinterpret_cast<const char*>(&_block), sizeof(_block));
+    _file.flush();
+    _in_block = false;
+}
+
+bool log_index_read(const std::string& filename, log_index_header& header,
+                    std::vector<log_index_entry>& entries) {
+    std::ifstream file(filename + LOG_INDEX_SUFFIX, std::ios_base::binary);
+    log_index_entry entry;
+
+    entries.clear();
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            header.magic != LOG_INDEX_MAGIC ||
+            header.version != LOG_INDEX_VERSION)
+        return false;
+
+    while (file.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+        entries.push_back(entry);
+    return true;
+}
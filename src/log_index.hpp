@@ -0,0 +1,108 @@
+#pragma once
+/*
+ * log_index.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "log_record.hpp"
+
+/**
+ * @brief Sidecar index of a log file, written by the file policies
+ * @brief (see set_index) in "<log file>.idx", and read by the
+ * @brief log_query tool to seek to a time range or a level without
+ * @brief scanning the whole log file.
+ * @brief The log file is cut in blocks of about interval bytes (whole
+ * @brief lines), each block is described by one log_index_entry,
+ * @brief appended once the block is complete, so the index is always
+ * @brief consistent with the file. The lines after the last entry
+ * @brief (block in progress, or crash) are not indexed.
+ */
+#define LOG_INDEX_MAGIC     0x58444947     // "GIDX"
+#define LOG_INDEX_VERSION   2
+#define LOG_INDEX_SUFFIX    ".idx"
+#define LOG_INDEX_LEVELS    6
+
+/**
+ * @brief LOG_INDEX_INTERVAL default block size in byte
+ */
+#define LOG_INDEX_INTERVAL  65536
+
+struct log_index_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t interval;
+};
+
+struct log_index_entry
+{
+    uint64_t offset;            // first byte of the block in the log file
+    uint64_t length;            // bytes of the block
+    int64_t min_ns;             // earliest and latest wall clock of the
+    int64_t max_ns;             // lines (not time ordered), ns since the epoch
+    uint64_t min_sequence;      // lowest line number (%i), 0 if unknown
+    uint32_t level_count[LOG_INDEX_LEVELS];     // lines per log_level
+};
+
+/**
+ * @brief log_index_writer is used by the file policies, the policy
+ * @brief tell each line written with its offset in the log file
+ */
+class log_index_writer
+{
+public:
+    log_index_writer();
+    ~log_index_writer();
+
+    /** @brief open() start the index of a log file
+     *  @param filename the log file, the index is filename + ".idx"
+     *  @param truncate the log file has been truncated, so is the index
+     *  @param interval block size in byte
+     */
+    bool open(const std::string& filename, bool truncate, uint64_t interval);
+
+    /** @brief close() write the block in progress and close
+     */
+    void close();
+
+    /** @brief add() count a line written at offset in the log file
+     */
+    void add(const log_record_view& record, uint64_t offset, size_t length);
+
+    /** @brief add() a line without record (write called directly)
+     */
+    void add(uint64_t offset, size_t length);
+
+    bool is_open() const { return _file.is_open(); }
+
+private:
+    void end_block();
+
+    std::ofstream _file;
+    uint64_t _interval;
+    bool _in_block;
+    log_index_entry _block;
+};
+
+/**
+ * @brief log_index_read() read the index of a log file
+ * @return false if the index doesn't exist or is not valid
+ */
+bool log_index_read(const std::string& filename, log_index_header& header,
+                    std::vector<log_index_entry>& entries);
@@ -1,18 +1,162 @@
 #include "log_policy.hpp"
+#include "log_clock.hpp"
 #include <cassert>
+#include <charconv>
 #include <filesystem>
 #include <sstream>
 //#include <stdio.h> //required if ::write(STDOUT_FILENO, ...);
 
 #include <iomanip>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
+static int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+* -----------------Implementation for file_sync-------------------------------
+*/
+
+file_sync::file_sync(durability mode, unsigned int interval_ms):
+                        _mode(mode),
+                        _interval_ns((int64_t) interval_ms * 1000000),
+                        _last_sync(0), _fd(-1), _dirty(false),
+                        _count(0), _total_ns(0), _max_ns(0) { }
+
+file_sync::~file_sync() {
+    detach();
+}
+
+void file_sync::attach(const std::string& filename) {
+    detach();
+    if (_mode == durability::none)
+        return;
+    _fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    _last_sync = steady_ns();
+}
+
+void file_sync::detach() {
+    if (_fd < 0)
+        return;
+    if (_dirty)
+        sync();
+    ::close(_fd);
+    _fd = -1;
+}
+
+void file_sync::flushed() {
+    if (_dirty && _mode == durability::periodic &&
+                        steady_ns() - _last_sync >= _interval_ns)
+        sync();
+}
+
+void file_sync::sync() {
+    if (_fd < 0 || !_dirty)
+        return;
+
+    int64_t start = steady_ns();
+    fdatasync(_fd);
+    _last_sync = steady_ns();
+    _dirty = false;
+
+    uint64_t elapsed = _last_sync - start;
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _total_ns.fetch_add(elapsed, std::memory_order_relaxed);
+    if (elapsed > _max_ns.load(std::memory_order_relaxed))
+        _max_ns.store(elapsed, std::memory_order_relaxed);
+}
+
+sync_stats file_sync::get_stats() const {
+    return sync_stats{ _count.load(std::memory_order_relaxed),
+                       _total_ns.load(std::memory_order_relaxed),
+                       _max_ns.load(std::memory_order_relaxed) };
+}
+
+/**
+* -----------------Implementation for shared_file-----------------------------
+*/
+
+shared_file::shared_file(): _fd(-1) { }
+
+shared_file::~shared_file() {
+    close();
+}
+
+/* The batch is kept for the new file */
+bool shared_file::open(const std::string& filename, bool truncate) {
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC |
+                                    (truncate ? O_TRUNC : 0), 0644);
+    return _fd >= 0;
+}
+
+void shared_file::close() {
+    if (_fd < 0)
+        return;
+    write_batch();
+    ::close(_fd);
+    _fd = -1;
+}
+
+void shared_file::write_batch(bool locked) {
+    if (_fd < 0 || _batch.empty())
+        return;
+
+    bool lock = !locked && _batch.size() > SHARED_FILE_ATOMIC_WRITE;
+    if (lock)
+        flock(_fd, LOCK_EX);
+
+    // One write for the batch, more only if it is partial
+    size_t done = 0;
+    while (done < _batch.size()) {
+        ssize_t n = ::write(_fd, _batch.data() + done, _batch.size() - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;      // i.e. ENOSPC, lines are lost
+        }
+        done += n;
+    }
+
+    if (lock)
+        flock(_fd, LOCK_UN);
+    _batch.clear();
+}
+
+uint64_t shared_file::size() const {
+    struct stat st;
+    if (_fd < 0 || fstat(_fd, &st) != 0)
+        return 0;
+    return st.st_size;
+}
+
 /**
 * -----------------Implementation for file_log_policy-------------------------
 */
 
+file_log_policy::file_log_policy(durability mode, unsigned int sync_interval_ms):
+                        _shared(false), _offset(0),
+                        _sync(mode, sync_interval_ms),
+                        _index_interval(0) { }
+
 file_log_policy::~file_log_policy() {
     close_out_stream();
 }
@@ -30,21 +174,264 @@ void file_log_policy::open_out_stream(const std::string& name) {
         fs::create_directory(path); // create folder
     }
 
+    if (_shared) {
+        _shared_file.open(name, false);
+        assert( _shared_file.is_open() == true );
+        _sync.attach(name);
+        return;
+    }
+
     _out_stream.open(name.c_str(), std::ios_base::binary |
                         std::ios_base::out | std::ofstream::app);
     assert( _out_stream.is_open() == true );
     _out_stream.precision(FLOAT_PRECISION);
+    _offset = fs::file_size(name);
+    _sync.attach(name);
+    if (_index_interval)
+        _index.open(name, false, _index_interval);
 }
 
 void file_log_policy::close_out_stream() {
+    if( _shared_file.is_open() ) {
+        _shared_file.close();
+        _sync.detach();
+    }
     if( _out_stream )
     {
+        _out_stream.flush();
+        _sync.detach();
         _out_stream.close();
     }
+    _index.close();
 }
 
+/* Lines are flushed by batch, in flush() */
 void file_log_policy::write(const std::string& msg) {
-    _out_stream << msg << std::flush;
+    write_line(msg);
+}
+
+void file_log_policy::write_record(const log_record& record) {
+    write_view(record);
+}
+
+void file_log_policy::write_view(const log_record_view& record) {
+    write_line(record.line);
+    _index.add(record, _offset - record.line.length(), record.line.length());
+}
+
+void file_log_policy::write_line(std::string_view msg) {
+    if (_shared) {
+        _shared_file.append(msg);
+        if (_shared_file.pending() >= SHARED_FILE_MAX_BATCH)
+            _shared_file.write_batch();
+    } else {
+        _out_stream << msg;
+    }
+    _offset += msg.length();
+    _sync.written();
+}
+
+void file_log_policy::flush() {
+    if (_shared)
+        _shared_file.write_batch();
+    else
+        _out_stream.flush();
+    _sync.flushed();
+}
+
+void file_log_policy::sync() {
+    if (_shared)
+        _shared_file.write_batch();
+    else
+        _out_stream.flush();
+    _sync.sync();
+}
+
+/**
+* -------------Implementation for direct_file_log_policy----------------------
+*/
+
+direct_file_log_policy::direct_file_log_policy(size_t buffer_size):
+                        _fd(-1), _buffers{ nullptr, nullptr },
+                        _active(0), _len(0), _buf_offset(0), _last_submit(0),
+                        _io_pending(false), _io_stop(false), _io_data(nullptr),
+                        _io_len(0), _io_offset(0), _io_truncate(0) {
+    _buffer_size = (buffer_size + DIRECT_FILE_BLOCK - 1) &
+                                        ~(size_t)(DIRECT_FILE_BLOCK - 1);
+    if (_buffer_size == 0)
+        _buffer_size = DIRECT_FILE_BLOCK;
+}
+
+direct_file_log_policy::~direct_file_log_policy() {
+    close_out_stream();
+}
+
+void direct_file_log_policy::open_out_stream(const std::string& name) {
+    size_t found;
+    std::string path;
+
+    found = name.find_last_of("/\\");
+    path = name.substr(0,found);
+
+    /* Create dir if it is not existing */
+    if (!fs::is_directory(path) || !fs::exists(path)) {
+        fs::create_directory(path); // create folder
+    }
+
+    _fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_DIRECT | O_CLOEXEC, 0644);
+    if (_fd < 0 && errno == EINVAL)     // O_DIRECT not supported
+        _fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    assert( _fd >= 0 );
+
+    for (auto& buffer : _buffers) {
+        void* mem = nullptr;
+        int ret = posix_memalign(&mem, DIRECT_FILE_BLOCK, _buffer_size);
+        assert( ret == 0 );
+        (void) ret;
+        buffer = static_cast<char*>(mem);
+    }
+
+    /* Append: the partial last block of the file is read in the buffer,
+     * it will be rewritten with the new data */
+    off_t size = lseek(_fd, 0, SEEK_END);
+    _active = 0;
+    _buf_offset = size & ~(off_t)(DIRECT_FILE_BLOCK - 1);
+    _len = size - _buf_offset;
+    if (_len > 0 && pread(_fd, _buffers[0], DIRECT_FILE_BLOCK,
+                                        _buf_offset) < (ssize_t)_len)
+        _len = 0;
+
+    _last_submit = steady_ns();
+    _io_stop = false;
+    _io = std::thread(&direct_file_log_policy::io_thread, this);
+}
+
+void direct_file_log_policy::close_out_stream() {
+    if (_fd < 0)
+        return;
+
+    submit(true);
+    wait_io();
+    {
+        std::scoped_lock<std::mutex> lock(_io_mutex);
+        _io_stop = true;
+    }
+    _io_cv.notify_all();
+    _io.join();
+
+    ::close(_fd);
+    _fd = -1;
+    for (auto& buffer : _buffers) {
+        free(buffer);
+        buffer = nullptr;
+    }
+}
+
+void direct_file_log_policy::write(const std::string& msg) {
+    const char* data = msg.data();
+    size_t remaining = msg.size();
+
+    while (remaining > 0) {
+        size_t chunk = std::min(remaining, _buffer_size - _len);
+        memcpy(_buffers[_active] + _len, data, chunk);
+        _len += chunk;
+        data += chunk;
+        remaining -= chunk;
+        if (_len == _buffer_size)
+            submit(false);
+    }
+}
+
+/* Full blocks are written after each batch, the partial
+ * last one only if it is too old
+ */
+void direct_file_log_policy::flush() {
+    if (_fd < 0)
+        return;
+    if (_len >= DIRECT_FILE_BLOCK)
+        submit(false);
+    else if (_len > 0 &&
+            steady_ns() - _last_submit > (int64_t)DIRECT_FILE_FLUSH_MS * 1000000)
+        submit(true);
+}
+
+void direct_file_log_policy::sync() {
+    if (_fd < 0)
+        return;
+    submit(true);
+    wait_io();
+    fdatasync(_fd);
+}
+
+void direct_file_log_policy::submit(bool pad) {
+    size_t full = _len & ~(size_t)(DIRECT_FILE_BLOCK - 1);
+    size_t write_len = pad ? (_len + DIRECT_FILE_BLOCK - 1) &
+                                ~(size_t)(DIRECT_FILE_BLOCK - 1) : full;
+    if (write_len == 0)
+        return;
+
+    char* buffer = _buffers[_active];
+    if (write_len > _len)
+        memset(buffer + _len, 0, write_len - _len);
+
+    wait_io();  // the other buffer is free once the I/O thread is idle
+
+    /* The partial block continue in the other buffer */
+    size_t tail = _len - full;
+    memcpy(_buffers[_active ^ 1], buffer + full, tail);
+
+    {
+        std::scoped_lock<std::mutex> lock(_io_mutex);
+        _io_data = buffer;
+        _io_len = write_len;
+        _io_offset = _buf_offset;
+        _io_truncate = write_len > _len ? _buf_offset + _len : 0;
+        _io_pending = true;
+    }
+    _io_cv.notify_all();
+
+    _active ^= 1;
+    _buf_offset += full;
+    _len = tail;
+    _last_submit = steady_ns();
+}
+
+void direct_file_log_policy::wait_io() {
+    std::unique_lock<std::mutex> lock(_io_mutex);
+    _io_cv.wait(lock, [this]{ return !_io_pending; });
+}
+
+void direct_file_log_policy::io_thread() {
+    std::unique_lock<std::mutex> lock(_io_mutex);
+
+    for (;;) {
+        _io_cv.wait(lock, [this]{ return _io_pending || _io_stop; });
+        if (!_io_pending)
+            return;     // stop, nothing left
+
+        const char* data = _io_data;
+        size_t len = _io_len;
+        uint64_t offset = _io_offset;
+        uint64_t truncate = _io_truncate;
+        lock.unlock();
+
+        while (len > 0) {
+            ssize_t n = pwrite(_fd, data, len, offset);
+            if (n <= 0 && errno != EINTR)
+                break;  // disk error, nothing we can do here
+            if (n > 0) {
+                data += n;
+                len -= n;
+                offset += n;
+            }
+        }
+        if (truncate)
+            ftruncate(_fd, truncate);
+
+        lock.lock();
+        _io_pending = false;
+        _io_cv.notify_all();
+    }
 }
 
 /**
@@ -52,9 +439,13 @@ void file_log_policy::write(const std::string& msg) {
 */
 
 ringfile_log_policy::ringfile_log_policy(uintmax_t max_size, 
-                        uint16_t max_file_count): 
+                        uint16_t max_file_count, durability mode,
+                        unsigned int sync_interval_ms): 
                         _max_size(max_size),
-                        _current_file_index(0) { 
+                        _current_file_index(0),
+                        _sync(mode, sync_interval_ms),
+                        _shared(false), _lock_fd(-1),
+                        _index_interval(0) { 
     if (max_file_count > 1)
         _max_index = max_file_count -1;
     else
@@ -105,6 +496,11 @@ void ringfile_log_policy::open_out_stream(const std::string& name) {
     /* last_index is either the last modified file either -1 
      * get the file size */
     _current_file_index = last_index < 0 ? 0: last_index;
+
+    if (_shared) {
+        open_shared();
+        return;
+    }
     next_filename = _path + "/" + _name + "." + 
                             std::to_string(_current_file_index);
 
@@ -132,6 +528,77 @@ void ringfile_log_policy::open_out_stream(const std::string& name) {
    
     assert( _out_stream.is_open() == true );
     _out_stream.precision(FLOAT_PRECISION);
+    _sync.attach(next_filename);
+    if (_index_interval)
+        _index.open(next_filename, _current_size == 0, _index_interval);
+}
+
+void ringfile_log_policy::open_shared() {
+    std::string lock_filename = _path + "/" + _name + ".lock";
+
+    _lock_fd = ::open(lock_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    assert( _lock_fd >= 0 );
+
+    // The first process set the current file, the others follow it
+    flock(_lock_fd, LOCK_EX);
+    long index = shared_file_index();
+    if (index < 0 || index > _max_index) {
+        std::string text = std::to_string(_current_file_index);
+        if (ftruncate(_lock_fd, 0) != 0 ||
+            pwrite(_lock_fd, text.data(), text.size(), 0) < 0)
+            perror(lock_filename.c_str());
+    } else {
+        _current_file_index = index;
+    }
+
+    std::string filename = _path + "/" + _name + "." +
+                            std::to_string(_current_file_index);
+    _shared_file.open(filename, false);
+    assert( _shared_file.is_open() == true );
+    flock(_lock_fd, LOCK_UN);
+    _sync.attach(filename);
+}
+
+long ringfile_log_policy::shared_file_index() {
+    char text[16];
+    ssize_t n = pread(_lock_fd, text, sizeof(text) - 1, 0);
+
+    if (n <= 0)
+        return -1;
+    text[n] = '\0';
+    return strtol(text, nullptr, 10);
+}
+
+void ringfile_log_policy::write_shared() {
+    if (_shared_file.pending() == 0)
+        return;
+
+    flock(_lock_fd, LOCK_EX);
+
+    // Another process may have rotated the file
+    long index = shared_file_index();
+    if (index >= 0 && index != _current_file_index) {
+        _current_file_index = index;
+        std::string filename = _path + "/" + _name + "." +
+                                std::to_string(_current_file_index);
+        _sync.detach();
+        _shared_file.open(filename, false);
+        _sync.attach(filename);
+    }
+
+    if (_shared_file.size() > 0 &&
+            _shared_file.size() + _shared_file.pending() > _max_size) {
+        std::string filename = _path + "/" + get_next_filename();
+        std::string text = std::to_string(_current_file_index);
+        _sync.detach();     // the file is complete, make it durable
+        _shared_file.open(filename, true);
+        _sync.attach(filename);
+        if (ftruncate(_lock_fd, 0) == 0)
+            pwrite(_lock_fd, text.data(), text.size(), 0);
+    }
+
+    _shared_file.write_batch(true);
+    flock(_lock_fd, LOCK_UN);
 }
 
 std::string ringfile_log_policy::get_next_filename() {
@@ -145,8 +612,11 @@ std::string ringfile_log_policy::get_next_filename() {
 }
 
 void ringfile_log_policy::rotate_file() {
-    if( _out_stream )
+    if( _out_stream ) {
+        _out_stream.flush();
+        _sync.detach();     // the file is complete, make it durable
         _out_stream.close();
+    }
 
     std::string next_filename = _path + "/" + get_next_filename();
 
@@ -155,32 +625,253 @@ void ringfile_log_policy::rotate_file() {
     assert( _out_stream.is_open() == true );
     _current_size = 0;
     _out_stream.precision(FLOAT_PRECISION);
+    _sync.attach(next_filename);
+
+    // The old index is complete, the one of the new file restart
+    if (_index_interval)
+        _index.open(next_filename, true, _index_interval);
 }
 
 void ringfile_log_policy::close_out_stream() {
+    if( _shared_file.is_open() ) {
+        write_shared();
+        _shared_file.close();
+        _sync.detach();
+        ::close(_lock_fd);
+        _lock_fd = -1;
+    }
     if( _out_stream ) {
+        _out_stream.flush();
+        _sync.detach();
         _out_stream.close();
     }
+    _index.close();
 }
 
 void ringfile_log_policy::write(const std::string& msg) {
+    write_line(msg);
+}
+
+void ringfile_log_policy::write_record(const log_record& record) {
+    write_view(record);
+}
+
+/* After write_line(), which may have rotated the file */
+void ringfile_log_policy::write_view(const log_record_view& record) {
+    write_line(record.line);
+    _index.add(record, _current_size - record.line.length(),
+                                            record.line.length());
+}
+
+/* Lines are flushed by batch, in flush() */
+void ringfile_log_policy::write_line(std::string_view msg) {
+    if (_shared) {
+        // A batch is written in one file, it is kept small enough so
+        // that the file is filled up to 1/16 of _max_size
+        if(_shared_file.pending() > 0 && _shared_file.pending() +
+                msg.length() > std::min<uintmax_t>(_max_size / 16,
+                                                   SHARED_FILE_MAX_BATCH))
+            write_shared();
+        _shared_file.append(msg);
+        _sync.written();
+        return;
+    }
+
     if(_current_size + msg.length() > _max_size)
         rotate_file();
 
     _current_size += msg.length();
 
-    _out_stream << msg << std::flush;
+    _out_stream << msg;
+    _sync.written();
+}
+
+void ringfile_log_policy::flush() {
+    if (_shared)
+        write_shared();
+    else
+        _out_stream.flush();
+    _sync.flushed();
+}
+
+void ringfile_log_policy::sync() {
+    if (_shared)
+        write_shared();
+    else
+        _out_stream.flush();
+    _sync.sync();
+}
+
+/**
+* -------------Implementation for binary_file_log_policy---------------------
+*/
+
+binary_file_log_policy::binary_file_log_policy() { }
+
+binary_file_log_policy::~binary_file_log_policy() {
+    close_out_stream();
+}
+
+void binary_file_log_policy::open_out_stream(const std::string& name) {
+    size_t found;
+    std::string path;
+
+    found = name.find_last_of("/\\");
+    path = name.substr(0,found);
+
+    /* Create dir if it is not existing */
+    if (!fs::is_directory(path) || !fs::exists(path)) {
+        fs::create_directory(path); // create folder
+    }
+
+    _out_stream.open(name.c_str(), std::ios_base::binary |
+                        std::ios_base::out | std::ofstream::app);
+    assert( _out_stream.is_open() == true );
+
+    // The ids of the previous sessions are not known, restart the table
+    _string_ids.clear();
+    log_binary_entry session = { (uint8_t)log_binary_type::session, 0, 0,
+                                 LOG_BINARY_MAGIC, LOG_BINARY_VERSION, 0,
+                                 log_clock::to_realtime_ns(log_clock::now()), 0 };
+    write_entry(session, "");
+}
+
+void binary_file_log_policy::close_out_stream() {
+    if( _out_stream ) {
+        _out_stream.flush();
+        _out_stream.close();
+    }
+}
+
+void binary_file_log_policy::write_entry(const log_binary_entry& entry,
+                                         const char* text) {
+    _out_stream.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    _out_stream.write(text, entry.length);
+}
+
+uint32_t binary_file_log_policy::string_id(const char* literal) {
+    auto it = _string_ids.find(literal);
+    if (it != _string_ids.end())
+        return it->second;
+
+    uint32_t id = _string_ids.size() + 1;
+    log_binary_entry entry = { (uint8_t)log_binary_type::string, 0, 0,
+                               id, 0, (uint32_t)strlen(literal), 0, 0 };
+    write_entry(entry, literal);
+    _string_ids.emplace(literal, id);
+    return id;
+}
+
+/* Lines written directly have no level */
+void binary_file_log_policy::write(const std::string& msg) {
+    log_binary_entry entry = { (uint8_t)log_binary_type::line, 0, 0, 0, 0,
+                               (uint32_t)msg.length(),
+                               log_clock::to_realtime_ns(log_clock::now()), 0 };
+    write_entry(entry, msg.data());
+}
+
+void binary_file_log_policy::write_record(const log_record& record) {
+    uint64_t ticks = record.timestamp ? record.timestamp : log_clock::now();
+    log_binary_entry entry = { (uint8_t)log_binary_type::line,
+                               (uint8_t)record.level, 0,
+                               record.literal ? string_id(record.literal) : 0,
+                               record.literal_offset,
+                               (uint32_t)record.line.length(),
+                               log_clock::to_realtime_ns(ticks),
+                               record.sequence };
+    write_entry(entry, record.line.data());
+}
+
+void binary_file_log_policy::flush() {
+    _out_stream.flush();
 }
 
 /**
 * -------------------Implementation for stdout_log_policy---------------------
 */
 
+stdout_log_policy::stdout_log_policy(int fd, color_mode color):
+                        _fd(fd), _tty(isatty(fd)), _last_write(0) {
+    if (color == color_mode::always || (color == color_mode::tty && _tty)) {
+        _colors[(int)log_level::debug] = "\x1b[2m";         // dim
+        _colors[(int)log_level::info] = "";
+        _colors[(int)log_level::notice] = "\x1b[36m";       // cyan
+        _colors[(int)log_level::warning] = "\x1b[33m";      // yellow
+        _colors[(int)log_level::error] = "\x1b[31m";        // red
+        _colors[(int)log_level::critical] = "\x1b[1;31m";   // bold red
+        _reset = "\x1b[0m";
+    }
+    _buffer.reserve(STDOUT_BLOCK_SIZE);
+}
+
+stdout_log_policy::~stdout_log_policy() {
+    close_out_stream();
+}
+
+void stdout_log_policy::close_out_stream() {
+    write_buffer();
+}
+
 void stdout_log_policy::write(const std::string& msg) {
+    _buffer.append(msg);
+    if (_buffer.size() >= STDOUT_BLOCK_SIZE)
+        write_buffer();
+}
+
+void stdout_log_policy::write_record(const log_record& record) {
+    write_view(record);
+}
+
+/* The color end before the '\n', so that it doesn't bleed on the
+ * next line if the output is cut */
+void stdout_log_policy::write_view(const log_record_view& record) {
+    const std::string& color = _colors[(int)record.level];
+
+    if (color.empty()) {
+        _buffer.append(record.line);
+    } else {
+        size_t len = record.line.length();
+        if (len > 0 && record.line[len - 1] == '\n')
+            len--;
+        _buffer.append(color);
+        _buffer.append(record.line.substr(0, len));
+        _buffer.append(_reset);
+        _buffer.append(record.line.substr(len));
+    }
+    if (_buffer.size() >= STDOUT_BLOCK_SIZE)
+        write_buffer();
+}
+
+void stdout_log_policy::flush() {
+    if (_buffer.empty())
+        return;
+    if (_tty || steady_ns() - _last_write >= (int64_t) STDOUT_FLUSH_MS * 1000000)
+        write_buffer();
+}
 
-    // write directly to the file descriptor to avoid the buffer
-    //::write(STDOUT_FILENO, msg .c_str(), msg .length());
-    std::cerr << msg << std::flush;
+void stdout_log_policy::sync() {
+    write_buffer();
+}
+
+void stdout_log_policy::write_buffer() {
+    size_t done = 0;
+
+    _last_write = steady_ns();
+    while (done < _buffer.size()) {
+        ssize_t n = ::write(_fd, _buffer.data() + done, _buffer.size() - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {     // non blocking pipe, wait for the reader
+                struct pollfd pfd = { _fd, POLLOUT, 0 };
+                poll(&pfd, 1, STDOUT_FLUSH_MS);
+                continue;
+            }
+            break;      // i.e. EPIPE, lines are lost
+        }
+        done += n;
+    }
+    _buffer.clear();
 }
 
 /**
@@ -189,7 +880,8 @@ void stdout_log_policy::write(const std::string& msg) {
 
 dailyfile_log_policy::dailyfile_log_policy(float decimal_rotate_hour, 
                         uint16_t max_file_count, const std::string &fmt): 
-                        _date_format(fmt) {
+                        _date_format(fmt), _offset(0),
+                        _index_interval(0) {
     if (max_file_count > 1)
         _max_file_count = max_file_count;
     else
@@ -270,6 +962,7 @@ void dailyfile_log_policy::close_out_stream() {
     if( _out_stream ) {
         _out_stream.close();
     }
+    _index.close();
 }
 
 void dailyfile_log_policy::rotate_file() {
@@ -286,6 +979,9 @@ void dailyfile_log_policy::rotate_file() {
                         std::ios_base::out | std::ofstream::app);
     assert( _out_stream.is_open() == true );
     _out_stream.precision(FLOAT_PRECISION);
+    _offset = fs::file_size(filename);
+    if (_index_interval)
+        _index.open(filename, false, _index_interval);
 
     delete_old_files();
 }
@@ -311,8 +1007,11 @@ void dailyfile_log_policy::delete_old_files() {
 
                 t_file = mktime(&tm_file);
                 int diff_days = (t_now - t_file) / (60 * 60 * 24);
-                if (diff_days > _max_file_count)
+                if (diff_days > _max_file_count) {
+                    std::error_code error;
                     remove(p);
+                    fs::remove(p.path().string() + LOG_INDEX_SUFFIX, error);
+                }
             }
 
         }
@@ -325,6 +1024,520 @@ void dailyfile_log_policy::write(const std::string& msg) {
         rotate_file();
 
     _out_stream << msg << std::flush;
+    _offset += msg.length();
+}
+
+/* After write(), which may have rotated the file */
+void dailyfile_log_policy::write_record(const log_record& record) {
+    write(record.line);
+    _index.add(record, _offset - record.line.length(), record.line.length());
+}
+
+/**
+* ---------------Implementation for segment_log_policy------------------------
+*/
+
+/* Resolution of a few ms, enough for the age and cheap for each line */
+static int64_t coarse_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+segment_log_policy::segment_log_policy(uintmax_t max_size,
+                        unsigned int max_age_s, uintmax_t disk_budget,
+                        durability mode, unsigned int sync_interval_ms):
+                        _max_size(max_size),
+                        _max_age_ns((int64_t) max_age_s * 1000000000),
+                        _disk_budget(disk_budget),
+                        _closed_size(0), _current_size(0),
+                        _segment_start(0),
+                        _sync(mode, sync_interval_ms),
+                        _index_interval(0) { }
+
+segment_log_policy::~segment_log_policy() {
+    close_out_stream();
+}
+
+std::string segment_log_policy::segment_filename(uint64_t number) const {
+    return _path + "/" + _name + "." + std::to_string(number);
+}
+
+void segment_log_policy::open_out_stream(const std::string& name) {
+    size_t found;
+
+    /* fill the class attribute */
+    found = name.find_last_of("/\\");
+    _path = name.substr(0,found);
+    _name = name.substr(found+1);
+
+    /* Create dir if it is not existing */
+    if (!fs::is_directory(_path) || !fs::exists(_path)) {
+        fs::create_directory(_path); // create folder
+    }
+
+    /* The only scan of the directory, the segments are then tracked */
+    _segments.clear();
+    for(const auto& p : fs::directory_iterator(_path)) {
+        if(p.path().stem() != _name || !p.is_regular_file())
+            continue;
+        // "<name>.<number>" only: no extension, "." or any other is skipped
+        std::string ext = p.path().extension().string();
+        if (ext.size() < 2 ||
+                ext.find_first_not_of("0123456789", 1) != std::string::npos)
+            continue;
+        // from_chars doesn't throw, a number too big for 64 bits is skipped
+        uint64_t number;
+        auto parsed = std::from_chars(ext.data() + 1, ext.data() + ext.size(),
+                                      number);
+        if (parsed.ec != std::errc())
+            continue;
+        _segments.push_back({ number, p.file_size() });
+    }
+    std::sort(_segments.begin(), _segments.end(),
+              [](const segment& a, const segment& b) {
+                  return a.number < b.number; });
+
+    // Append to the last segment if there is room left
+    if (_segments.empty())
+        _segments.push_back({ 0, 0 });
+    else if (_segments.back().size >= _max_size)
+        _segments.push_back({ _segments.back().number + 1, 0 });
+
+    _closed_size = 0;
+    for (size_t i = 0; i + 1 < _segments.size(); i++)
+        _closed_size += _segments[i].size;
+
+    open_segment();
+    apply_budget();
+}
+
+void segment_log_policy::open_segment() {
+    std::string filename = segment_filename(_segments.back().number);
+
+    _current_size = _segments.back().size;
+    _out_stream.open(filename.c_str(), std::ios_base::binary |
+                        std::ios_base::out | std::ofstream::app);
+    assert( _out_stream.is_open() == true );
+    _out_stream.precision(FLOAT_PRECISION);
+
+    // Reserve the whole segment at once, the file size is unchanged
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (_max_size > _current_size)
+            fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, _max_size);
+        ::close(fd);
+    }
+
+    _segment_start = coarse_ns();
+    _sync.attach(filename);
+    if (_index_interval)
+        _index.open(filename, _current_size == 0, _index_interval);
+}
+
+void segment_log_policy::close_segment() {
+    if( !_out_stream.is_open() )
+        return;
+
+    _out_stream.flush();
+    _sync.detach();     // the segment is complete, make it durable
+    _out_stream.close();
+    _index.close();
+
+    // Release the preallocated blocks beyond the end
+    std::error_code error;
+    fs::resize_file(segment_filename(_segments.back().number),
+                    _current_size, error);
+    _segments.back().size = _current_size;
+}
+
+void segment_log_policy::rotate_file() {
+    close_segment();
+    _closed_size += _current_size;
+    _segments.push_back({ _segments.back().number + 1, 0 });
+    open_segment();
+    apply_budget();
+}
+
+void segment_log_policy::apply_budget() {
+    while (_segments.size() > 1 && _closed_size + _max_size > _disk_budget) {
+        std::string filename = segment_filename(_segments.front().number);
+        std::error_code error;
+
+        fs::remove(filename, error);
+        fs::remove(filename + LOG_INDEX_SUFFIX, error);
+        _closed_size -= _segments.front().size;
+        _segments.pop_front();
+    }
+}
+
+void segment_log_policy::close_out_stream() {
+    close_segment();
+}
+
+void segment_log_policy::write(const std::string& msg) {
+    write_line(msg);
+}
+
+void segment_log_policy::write_record(const log_record& record) {
+    write_view(record);
+}
+
+/* After write_line(), which may have rotated the file */
+void segment_log_policy::write_view(const log_record_view& record) {
+    write_line(record.line);
+    _index.add(record, _current_size - record.line.length(),
+                                            record.line.length());
+}
+
+/* Lines are flushed by batch, in flush(). A line is never cut, a
+ * line bigger than a segment is alone in its segment */
+void segment_log_policy::write_line(std::string_view msg) {
+    if (_current_size > 0 && (_current_size + msg.length() > _max_size ||
+            (_max_age_ns > 0 && coarse_ns() - _segment_start >= _max_age_ns)))
+        rotate_file();
+
+    _current_size += msg.length();
+
+    _out_stream << msg;
+    _sync.written();
+}
+
+void segment_log_policy::flush() {
+    _out_stream.flush();
+    _sync.flushed();
+}
+
+void segment_log_policy::sync() {
+    _out_stream.flush();
+    _sync.sync();
+}
+
+/**
+* -----------------Implementation for shm_log_policy---------------------------
+*/
+
+shm_log_policy::shm_log_policy(uint64_t capacity, bool unlink_on_close):
+                        _capacity(capacity),
+                        _unlink_on_close(unlink_on_close) { }
+
+shm_log_policy::~shm_log_policy() {
+    close_out_stream();
+}
+
+void shm_log_policy::open_out_stream(const std::string& name) {
+    std::string shm_name = "/" + name.substr(name.find_last_of("/\\") + 1);
+
+    _ring.open(shm_name, _capacity);
+    assert( _ring.is_open() == true );
+}
+
+void shm_log_policy::close_out_stream() {
+    _ring.close(_unlink_on_close);
+}
+
+void shm_log_policy::write(const std::string& msg) {
+    _ring.write(msg.data(), msg.size());
+}
+
+/**
+* -------------Implementation for unix_socket_log_policy----------------------
+*/
+
+static int64_t steady_ms() {
+    return steady_ns() / 1000000;
+}
+
+unix_socket_log_policy::unix_socket_log_policy(const std::string& socket_path,
+                        size_t max_pending):
+                        _socket_path(socket_path), _fd(-1),
+                        _next_retry(0), _max_pending(max_pending),
+                        _dropped(0) {
+    if (_max_pending == 0)
+        _max_pending = 1;
+}
+
+unix_socket_log_policy::~unix_socket_log_policy() {
+    close_out_stream();
+}
+
+void unix_socket_log_policy::open_out_stream(const std::string& name) {
+    _name = name.substr(name.find_last_of("/\\") + 1);
+    connect_socket();   // not an error if the daemon is not there
+}
+
+void unix_socket_log_policy::close_out_stream() {
+    if (_fd >= 0)
+        flush();    // last attempt, never blocking
+    disconnect_socket();
+}
+
+bool unix_socket_log_policy::connect_socket() {
+    struct sockaddr_un addr = {};
+
+    _next_retry = steady_ms() + UNIX_SOCKET_RETRY_MS;
+    if (_socket_path.size() >= sizeof(addr.sun_path))
+        return false;
+
+    _fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0)
+        return false;
+
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, _socket_path.c_str(), _socket_path.size());
+    if (::connect(_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        disconnect_socket();
+        return false;
+    }
+    return true;
+}
+
+void unix_socket_log_policy::disconnect_socket() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+void unix_socket_log_policy::format(const log_record& record,
+                                        std::string& datagram) {
+    datagram.assign(record.line);
+    if (!datagram.empty() && datagram.back() == '\n')
+        datagram.pop_back();
+}
+
+void unix_socket_log_policy::write(const std::string& msg) {
+    write_record(log_record{ log_level::info, msg });
+}
+
+void unix_socket_log_policy::write_record(const log_record& record) {
+    if (_pending.size() >= _max_pending) {
+        _pending.pop_front();   // keep the most recent lines
+        _dropped++;
+    }
+    _pending.emplace_back();
+    format(record, _pending.back());
+}
+
+void unix_socket_log_policy::flush() {
+    struct mmsghdr msgs[UNIX_SOCKET_BATCH];
+    struct iovec iovs[UNIX_SOCKET_BATCH];
+
+    if (_pending.empty())
+        return;
+
+    if (_fd < 0) {
+        if (steady_ms() < _next_retry || !connect_socket())
+            return;
+    }
+
+    if (_dropped) {     // Tell the daemon that it missed something
+        log_record note{ log_level::warning,
+                std::to_string(_dropped) + " lines dropped, "
+                "log daemon was not reachable\n" };
+        _pending.emplace_front();
+        format(note, _pending.front());
+        _dropped = 0;
+    }
+
+    while (!_pending.empty()) {
+        unsigned int count = 0;
+        for (auto it = _pending.begin(); it != _pending.end() &&
+                                    count < UNIX_SOCKET_BATCH; ++it, ++count) {
+            iovs[count].iov_base = const_cast<char*>(it->data());
+            iovs[count].iov_len = it->size();
+            memset(&msgs[count], 0, sizeof(msgs[count]));
+            msgs[count].msg_hdr.msg_iov = &iovs[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = sendmmsg(_fd, msgs, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                return;     // daemon is slow, retry on next flush
+            if (errno == EMSGSIZE) {    // can't be sent, drop it
+                _pending.pop_front();
+                continue;
+            }
+            // daemon restarted (ECONNREFUSED, ENOTCONN...), reconnect later
+            disconnect_socket();
+            _next_retry = steady_ms() + UNIX_SOCKET_RETRY_MS;
+            return;
+        }
+        _pending.erase(_pending.begin(), _pending.begin() + sent);
+        if ((unsigned int) sent < count)
+            return;
+    }
+}
+
+/**
+* ---------------Implementation for syslog_log_policy-------------------------
+*/
+
+syslog_log_policy::syslog_log_policy(const std::string& socket_path,
+                        unsigned int facility, const std::string& app_name,
+                        size_t max_pending):
+                        unix_socket_log_policy(socket_path, max_pending),
+                        _facility(facility > 23 ? 1 : facility),
+                        _app_name(app_name) { }
+
+void syslog_log_policy::open_out_stream(const std::string& name) {
+    char host[256];
+
+    if (gethostname(host, sizeof(host)) == 0) {
+        host[sizeof(host) - 1] = '\0';
+        _hostname = host;
+    }
+    if (_hostname.empty())
+        _hostname = "-";
+    _procid = std::to_string(getpid());
+
+    unix_socket_log_policy::open_out_stream(name);
+    if (_app_name.empty())
+        _app_name = _name;
+}
+
+/* <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD MSG */
+void syslog_log_policy::format(const log_record& record,
+                                    std::string& datagram) {
+    static const unsigned int severity[] = {
+        7,  // unused
+        7,  // debug
+        6,  // info
+        5,  // notice
+        4,  // warning
+        3,  // error
+        2   // critical
+    };
+    unsigned int level = static_cast<unsigned int>(record.level);
+    char ts[48];
+
+    // When the line was logged, not when its batch is sent
+    uint64_t ticks = record.timestamp ? record.timestamp : log_clock::now();
+    int64_t ns = log_clock::to_realtime_ns(ticks);
+    time_t t = ns / 1000000000;
+    long us = (ns % 1000000000) / 1000;
+    std::tm tm;
+    gmtime_r(&t, &tm);
+    size_t len = strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(ts + len, sizeof(ts) - len, ".%06ldZ", us);
+
+    datagram.clear();
+    datagram.push_back('<');
+    datagram.append(std::to_string(_facility * 8 + severity[level < 7 ? level : 0]));
+    datagram.append(">1 ");
+    datagram.append(ts);
+    datagram.push_back(' ');
+    datagram.append(_hostname);
+    datagram.push_back(' ');
+    datagram.append(_app_name);
+    datagram.push_back(' ');
+    datagram.append(_procid);
+    datagram.append(" - - ");
+    datagram.append(record.line);
+    if (datagram.back() == '\n')
+        datagram.pop_back();
+}
+
+/**
+* -----------Implementation for flight_recorder_log_policy-------------------
+*/
+
+flight_recorder_log_policy::flight_recorder_log_policy(size_t capacity,
+                                                    log_level dump_level):
+                        _ring(capacity < 1024 ? 1024 : capacity),
+                        _head(0), _tail(0), _lines(0),
+                        _dump_level(dump_level),
+                        _dump_requested(false), _dumps(0) { }
+
+void flight_recorder_log_policy::open_out_stream(const std::string& name) {
+    _filename = name + FLIGHT_RECORDER_SUFFIX;
+}
+
+void flight_recorder_log_policy::close_out_stream() {
+    if (_dump_requested.exchange(false))
+        dump_window("requested");
+}
+
+void flight_recorder_log_policy::write(const std::string& msg) {
+    store(msg);
+}
+
+void flight_recorder_log_policy::write_record(const log_record& record) {
+    store(record.line);
+    if (record.level >= _dump_level)
+        dump_window(record.level == log_level::critical ? "critical" : "error");
+}
+
+void flight_recorder_log_policy::flush() {
+    if (_dump_requested.load(std::memory_order_relaxed) &&
+            _dump_requested.exchange(false))
+        dump_window("requested");
+}
+
+void flight_recorder_log_policy::dump() {
+    _dump_requested.store(true);
+}
+
+uint64_t flight_recorder_log_policy::get_dump_count() const {
+    return _dumps.load();
+}
+
+void flight_recorder_log_policy::copy_in(uint64_t pos, const void* data,
+                                                            size_t len) {
+    size_t offset = pos % _ring.size();
+    size_t first = std::min(len, _ring.size() - offset);
+
+    memcpy(_ring.data() + offset, data, first);
+    memcpy(_ring.data(), static_cast<const char*>(data) + first, len - first);
+}
+
+void flight_recorder_log_policy::copy_out(uint64_t pos, void* data,
+                                                        size_t len) const {
+    size_t offset = pos % _ring.size();
+    size_t first = std::min(len, _ring.size() - offset);
+
+    memcpy(data, _ring.data() + offset, first);
+    memcpy(static_cast<char*>(data) + first, _ring.data(), len - first);
+}
+
+void flight_recorder_log_policy::store(const std::string& line) {
+    uint32_t len = std::min(line.size(), _ring.size() - sizeof(uint32_t));
+    uint64_t size = sizeof(len) + len;
+
+    // Evict the oldest records
+    while (_tail + size - _head > _ring.size()) {
+        uint32_t old_len;
+        copy_out(_head, &old_len, sizeof(old_len));
+        _head += sizeof(old_len) + old_len;
+        _lines--;
+    }
+
+    copy_in(_tail, &len, sizeof(len));
+    copy_in(_tail + sizeof(len), line.data(), len);
+    _tail += size;
+    _lines++;
+}
+
+void flight_recorder_log_policy::dump_window(const char* reason) {
+    std::ofstream out(_filename, std::ios_base::out | std::ios_base::app);
+    std::string line;
+
+    out << "======== flight recorder dump (" << reason << "), "
+        << _lines << " lines ========\n";
+    for (uint64_t pos = _head; pos < _tail; ) {
+        uint32_t len;
+        copy_out(pos, &len, sizeof(len));
+        line.resize(len);
+        copy_out(pos + sizeof(len), &line[0], len);
+        out << line;
+        pos += sizeof(len) + len;
+    }
+    out.flush();
+
+    _head = _tail;
+    _lines = 0;
+    _dumps++;
 }
 
 /**
@@ -357,3 +1570,43 @@ void spread_log_policy::write(const std::string& msg) {
 	    (*it)->write(msg);
     }
 }
+
+void spread_log_policy::write_record(const log_record& record) {
+    for(auto it=_policy_list.begin(); it!=_policy_list.end(); ++it) {
+	    (*it)->write_record(record);
+    }
+}
+
+void spread_log_policy::write_view(const log_record_view& record) {
+    for(auto it=_policy_list.begin(); it!=_policy_list.end(); ++it) {
+	    (*it)->write_view(record);
+    }
+}
+
+void spread_log_policy::flush() {
+    for(auto it=_policy_list.begin(); it!=_policy_list.end(); ++it) {
+	    (*it)->flush();
+    }
+}
+
+void spread_log_policy::sync() {
+    for(auto it=_policy_list.begin(); it!=_policy_list.end(); ++it) {
+	    (*it)->sync();
+    }
+}
+
+bool spread_log_policy::accept_literals() const {
+    for(auto it=_policy_list.begin(); it!=_policy_list.end(); ++it) {
+        if (!(*it)->accept_literals())
+            return false;
+    }
+    return true;
+}
+
+bool spread_log_policy::accept_views() const {
+    for(auto it=_policy_list.begin(); it!=_policy_list.end(); ++it) {
+        if (!(*it)->accept_views())
+            return false;
+    }
+    return true;
+}
@@ -18,7 +18,19 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include <string>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "log_record.hpp"
+#include "shm_ring.hpp"
+#include "log_index.hpp"
+#include "log_binary.hpp"
 
 #define FLOAT_PRECISION 10
 
@@ -33,23 +45,308 @@ public:
     virtual void open_out_stream(const std::string& name) = 0;
     virtual void close_out_stream() = 0;
     virtual void write(const std::string& msg) = 0;
+
+    /** @brief write_record() called by the logger daemon for each line
+     *  @brief policies that need the level (or other informations
+     *  @brief about the line) override it, others just implement write
+     */
+    virtual void write_record(const log_record& record) {
+        write(record.line);
+    }
+
+    /** @brief flush() called by the logger daemon after each batch of
+     *  @brief lines, and every LOGGER_DELAY ms when idle. Policies
+     *  @brief that buffer or batch their output send it here
+     */
+    virtual void flush() { }
+
+    /** @brief sync() called by the logger daemon when a producer
+     *  @brief wait for its line to be durable (logger::print_durable),
+     *  @brief after flush(). One sync cover all the lines written before.
+     *  @brief Policies writing to a file make the data durable here
+     */
+    virtual void sync() { }
+
+    /** @brief accept_literals() true if write_record handle the records
+     *  @brief with a literal (see log_record), i.e. with a string table.
+     *  @brief Otherwise the daemon insert the literal in the line first
+     */
+    virtual bool accept_literals() const { return false; }
+
+    /** @brief write_view() called by the logger daemon instead of
+     *  @brief write_record if accept_views(): the line is read in place
+     *  @brief in the queue of the logger (see record_ring), without copy
+     */
+    virtual void write_view(const log_record_view& record) {
+        write_record(log_record{ record.level, std::string(record.line),
+                                 record.timestamp, record.sequence,
+                                 record.literal, record.literal_offset });
+    }
+
+    /** @brief accept_views() true if write_view is implemented
+     */
+    virtual bool accept_views() const { return false; }
 };
 
 inline log_policy_interface::~log_policy_interface(){}
 
+/**
+ * @brief durability of the file policies
+ * @param none data is given to the kernel (flushed) after each batch
+ * @param periodic in addition, fdatasync every sync_interval_ms
+ * @param group_commit in addition, fdatasync each time a producer wait
+ *        for its line (logger::print_durable). One fdatasync cover
+ *        all the lines of the batch
+ */
+enum class durability
+{
+    none = 1,
+    periodic,
+    group_commit
+};
+
+/**
+ * @brief sync_stats fdatasync count and latency of a file policy
+ */
+struct sync_stats
+{
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+/**
+ * @brief file_sync perform the fdatasync of the file policies
+ * @brief according to their durability mode, and keep the stats.
+ * @brief std::ofstream doesn't give its fd, so a read only fd
+ * @brief is opened on the same file (fdatasync act on the inode)
+ */
+class file_sync
+{
+public:
+    file_sync(durability mode, unsigned int interval_ms);
+    ~file_sync();
+
+    /** @brief attach() open the fd used to sync filename
+     */
+    void attach(const std::string& filename);
+
+    /** @brief detach() sync (unless mode is none) and close the fd
+     */
+    void detach();
+
+    /** @brief written() to be called when data is written
+     */
+    void written() { _dirty = true; }
+
+    /** @brief flushed() to be called after the stream is flushed
+     *  @brief sync if the periodic interval is elapsed
+     */
+    void flushed();
+
+    /** @brief sync() fdatasync now (the stream shall be flushed)
+     */
+    void sync();
+
+    sync_stats get_stats() const;
+    durability mode() const { return _mode; }
+
+private:
+    durability _mode;
+    int64_t _interval_ns;
+    int64_t _last_sync;
+    int _fd;
+    bool _dirty;    // data written since last sync
+
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _total_ns;
+    std::atomic<uint64_t> _max_ns;
+};
+
+/**
+ * @brief SHARED_FILE_ATOMIC_WRITE batches up to this size are written
+ * @brief without lock (a write of a regular file is not interleaved)
+ * @brief SHARED_FILE_MAX_BATCH the batch is written once this size is
+ * @brief reached, without waiting for the end of the logger batch
+ */
+#define SHARED_FILE_ATOMIC_WRITE    4096
+#define SHARED_FILE_MAX_BATCH       1048576
+
+/**
+ * @brief shared_file append whole lines to a file shared by several
+ * @brief processes: the file is opened with O_APPEND, and the lines of
+ * @brief a batch are given to the kernel with a single write(). A batch
+ * @brief bigger than SHARED_FILE_ATOMIC_WRITE may be partially written,
+ * @brief so it is written under an flock of the file, held until the
+ * @brief whole batch is written
+ */
+class shared_file
+{
+public:
+    shared_file();
+    ~shared_file();
+
+    /** @brief open() the file, created if required. The lines not
+     *  @brief written yet will be written in this file
+     */
+    bool open(const std::string& filename, bool truncate);
+
+    /** @brief close() write the batch and close
+     */
+    void close();
+
+    bool is_open() const { return _fd >= 0; }
+    void append(std::string_view msg) { _batch.append(msg); }
+    size_t pending() const { return _batch.size(); }
+
+    /** @brief write_batch() write the lines appended
+     *  @param locked the caller already serialize the writers
+     */
+    void write_batch(bool locked = false);
+
+    /** @brief size() of the file, written by all the processes
+     */
+    uint64_t size() const;
+
+private:
+    int _fd;
+    std::string _batch;
+};
+
 /**
  * @brief Implementation which allow to write into a file
  */
 class file_log_policy : public log_policy_interface
 {
 public:
-    file_log_policy(){   }
+    /** @param mode durability, see durability enum
+     *  @param sync_interval_ms fdatasync period for durability::periodic
+     */
+    file_log_policy(durability mode = durability::none,
+                    unsigned int sync_interval_ms = 1000);
     ~file_log_policy();
     void open_out_stream(const std::string& name);
     void close_out_stream();
     void write(const std::string& msg);
+    void write_record(const log_record& record);
+    void write_view(const log_record_view& record);
+    bool accept_views() const { return true; }
+    void flush();
+    void sync();
+
+    /** @brief set_index() write a sidecar index of the log file
+     *  @brief (see log_index.hpp), one entry per block of interval
+     *  @brief bytes. To be called before the logger is built
+     */
+    void set_index(uint64_t interval = LOG_INDEX_INTERVAL) { _index_interval = interval; }
+
+    /** @brief set_shared() the file is shared with other processes,
+     *  @brief see shared_file. The index is not written in this mode.
+     *  @brief To be called before the logger is built
+     */
+    void set_shared() { _shared = true; }
+
+    /** @brief get_sync_stats() fdatasync count and latency
+     */
+    sync_stats get_sync_stats() const { return _sync.get_stats(); }
 private:
+    /** @brief write_line() write a line, in place from the queue
+     */
+    void write_line(std::string_view msg);
+
     std::ofstream _out_stream;
+
+    /** @brief _shared_file : used instead of _out_stream if _shared
+     */
+    bool _shared;
+    shared_file _shared_file;
+
+    /** @brief _offset : size of the file, i.e. offset of the next line
+     */
+    uint64_t _offset;
+
+    /** @brief _sync : durability of the file
+     */
+    file_sync _sync;
+
+    /** @brief _index : sidecar index, if _index_interval is not 0
+     */
+    log_index_writer _index;
+    uint64_t _index_interval;
+};
+
+/**
+ * @brief DIRECT_FILE_BLOCK alignment of O_DIRECT buffers, offsets and sizes
+ * @brief DIRECT_FILE_FLUSH_MS max time a partial block stay in memory
+ */
+#define DIRECT_FILE_BLOCK       4096
+#define DIRECT_FILE_FLUSH_MS    1000
+
+/**
+ * @brief Implementation to write into a file with O_DIRECT, so that
+ * @brief log data doesn't evict anything from the page cache.
+ * @brief Lines are accumulated in DIRECT_FILE_BLOCK aligned buffers.
+ * @brief Two buffers are used: one is filled by the logger thread while
+ * @brief the other is written by the I/O thread. Only full blocks are
+ * @brief written, the partial last block is kept for the next buffer
+ * @brief until it is full, DIRECT_FILE_FLUSH_MS is elapsed, or the file
+ * @brief is closed: then it is written padded with zeros and the file
+ * @brief is truncated to its real size (the block is rewritten later).
+ * @brief If the filesystem doesn't support O_DIRECT (i.e. tmpfs), the
+ * @brief file is opened without it.
+ */
+class direct_file_log_policy : public log_policy_interface
+{
+public:
+    /** @param buffer_size size of each of the 2 buffers, in byte
+     *          rounded up to DIRECT_FILE_BLOCK
+     */
+    direct_file_log_policy(size_t buffer_size = 1048576);
+    ~direct_file_log_policy();
+    void open_out_stream(const std::string& name);
+    void close_out_stream();
+    void write(const std::string& msg);
+    void flush();
+    void sync();
+private:
+    /** @brief submit() give the active buffer to the I/O thread, and
+     *  @brief switch to the other one (the tail block is copied in it)
+     *  @param pad write also the partial last block, padded
+     */
+    void submit(bool pad);
+
+    /** @brief wait_io() wait until the I/O thread is idle
+     */
+    void wait_io();
+
+    /** @brief io_thread() perform the writes
+     */
+    void io_thread();
+
+    int _fd;
+    size_t _buffer_size;
+    char* _buffers[2];
+
+    /** @brief _active : index of the buffer being filled,
+     *  @brief _len : bytes in the active buffer
+     *  @brief _buf_offset : file offset of the active buffer (aligned)
+     */
+    int _active;
+    size_t _len;
+    uint64_t _buf_offset;
+    int64_t _last_submit;
+
+    /** @brief I/O thread request, protected by _io_mutex
+     */
+    std::thread _io;
+    std::mutex _io_mutex;
+    std::condition_variable _io_cv;
+    bool _io_pending;
+    bool _io_stop;
+    const char* _io_data;
+    size_t _io_len;
+    uint64_t _io_offset;
+    uint64_t _io_truncate;  // file size after the write, 0 if not padded
 };
 
 /**
@@ -62,12 +359,55 @@ public:
      *  @param defaut value is 1MB
     */
     ringfile_log_policy(uintmax_t max_size = 1048576, 
-                        uint16_t max_file_count = 2);
+                        uint16_t max_file_count = 2,
+                        durability mode = durability::none,
+                        unsigned int sync_interval_ms = 1000);
     ~ringfile_log_policy();
     void open_out_stream(const std::string& name);
     void close_out_stream();
     void write(const std::string& msg);
+    void write_record(const log_record& record);
+    void write_view(const log_record_view& record);
+    bool accept_views() const { return true; }
+    void flush();
+    void sync();
+
+    /** @brief set_index() write a sidecar index of the log file
+     *  @brief (see log_index.hpp), one entry per block of interval
+     *  @brief bytes. To be called before the logger is built
+     */
+    void set_index(uint64_t interval = LOG_INDEX_INTERVAL) { _index_interval = interval; }
+
+    /** @brief set_shared() the files are shared with other processes,
+     *  @brief see shared_file. The current file index is kept in
+     *  @brief name.lock, which is locked by the process writing a batch,
+     *  @brief so that the file is rotated once for all the processes.
+     *  @brief The index is not written in this mode.
+     *  @brief To be called before the logger is built
+     */
+    void set_shared() { _shared = true; }
+
+    /** @brief get_sync_stats() fdatasync count and latency
+     */
+    sync_stats get_sync_stats() const { return _sync.get_stats(); }
 private:
+    /** @brief write_line() write a line, in place from the queue
+     */
+    void write_line(std::string_view msg);
+
+    /** @brief open_shared() open the lock file and the current file
+     */
+    void open_shared();
+
+    /** @brief write_shared() write the batch under the lock file,
+     *  @brief after following or doing the rotation
+     */
+    void write_shared();
+
+    /** @brief shared_file_index() read the current file index in the
+     *  @brief lock file, -1 if none
+     */
+    long shared_file_index();
 
     /** @brief get_next_filename
      *  @return the filename (without base path)
@@ -114,6 +454,22 @@ private:
      */
     std::string _path;
 
+    /** @brief _sync : durability of the current file
+     */
+    file_sync _sync;
+
+    /** @brief _shared_file : used instead of _out_stream if _shared
+     *  @brief _lock_fd : the lock file, holding the current file index
+     */
+    bool _shared;
+    shared_file _shared_file;
+    int _lock_fd;
+
+    /** @brief _index : sidecar index of the current file,
+     *  @brief restarted on rotation, if _index_interval is not 0
+     */
+    log_index_writer _index;
+    uint64_t _index_interval;
 };
 
 /**
@@ -135,6 +491,13 @@ public:
     void open_out_stream(const std::string& name);
     void close_out_stream();
     void write(const std::string& msg);
+    void write_record(const log_record& record);
+
+    /** @brief set_index() write a sidecar index of the log file
+     *  @brief (see log_index.hpp), one entry per block of interval
+     *  @brief bytes. To be called before the logger is built
+     */
+    void set_index(uint64_t interval = LOG_INDEX_INTERVAL) { _index_interval = interval; }
 private:
 
     /** @brief get_next_filename
@@ -199,19 +562,422 @@ private:
     /** @brief _path : path of the file
      */
     std::string _path;
+
+    /** @brief _offset : size of the current file
+     */
+    uint64_t _offset;
+
+    /** @brief _index : sidecar index of the current file,
+     *  @brief deleted with it, if _index_interval is not 0
+     */
+    log_index_writer _index;
+    uint64_t _index_interval;
 };
 
 /**
- * @brief Implementation log to stdout
+ * @brief Implementation to write on numbered segments (name.0, name.1,
+ * @brief ...), rotated at max_size or max_age, whichever first. Each
+ * @brief segment is preallocated (fallocate, the file size is kept) so
+ * @brief that it is contiguous on disk, the space beyond the end is
+ * @brief released when it is closed. The oldest segments are deleted
+ * @brief when the total size would exceed disk_budget (the current
+ * @brief segment counts for max_size). The directory is only scanned
+ * @brief at startup, then the segments are tracked in memory.
+ */
+class segment_log_policy : public log_policy_interface
+{
+public:
+    /** @param max_size max size of a segment in byte
+     *  @param max_age_s max age of a segment in second, 0 for none
+     *  @param disk_budget max total size of the segments in byte
+     *  @param mode durability, see durability enum
+     *  @param sync_interval_ms fdatasync period for durability::periodic
+     */
+    segment_log_policy(uintmax_t max_size = 64 * 1048576,
+                       unsigned int max_age_s = 3600,
+                       uintmax_t disk_budget = 1024 * 1048576,
+                       durability mode = durability::none,
+                       unsigned int sync_interval_ms = 1000);
+    ~segment_log_policy();
+    void open_out_stream(const std::string& name);
+    void close_out_stream();
+    void write(const std::string& msg);
+    void write_record(const log_record& record);
+    void write_view(const log_record_view& record);
+    bool accept_views() const { return true; }
+    void flush();
+    void sync();
+
+    /** @brief set_index() write a sidecar index of the log file
+     *  @brief (see log_index.hpp), one entry per block of interval
+     *  @brief bytes. To be called before the logger is built
+     */
+    void set_index(uint64_t interval = LOG_INDEX_INTERVAL) { _index_interval = interval; }
+
+    /** @brief get_sync_stats() fdatasync count and latency
+     */
+    sync_stats get_sync_stats() const { return _sync.get_stats(); }
+private:
+    /** @brief write_line() write a line, in place from the queue
+     */
+    void write_line(std::string_view msg);
+
+    struct segment
+    {
+        uint64_t number;
+        uintmax_t size;
+    };
+
+    std::string segment_filename(uint64_t number) const;
+
+    /** @brief open_segment() open the last segment of _segments,
+     *  @brief appending if it is not empty, and preallocate it
+     */
+    void open_segment();
+
+    /** @brief close_segment() close the current segment and release
+     *  @brief the preallocated space beyond its end
+     */
+    void close_segment();
+
+    /** @brief rotate_file() close the current segment, open the next
+     *  @brief one and apply the disk budget
+     */
+    void rotate_file();
+
+    /** @brief apply_budget() delete the oldest segments
+     */
+    void apply_budget();
+
+    std::ofstream _out_stream;
+
+    uintmax_t _max_size;
+    int64_t _max_age_ns;
+    uintmax_t _disk_budget;
+
+    /** @brief _segments : oldest first, the last one is the current
+     *  @brief _closed_size : total size of the segments but the current
+     *  @brief _current_size : size of the current segment
+     *  @brief _segment_start : monotonic ns when the current was opened
+     */
+    std::deque<segment> _segments;
+    uintmax_t _closed_size;
+    uintmax_t _current_size;
+    int64_t _segment_start;
+
+    /** @brief _name : name without numeric extension
+     */
+    std::string _name;
+
+    /** @brief _path : path of the file
+     */
+    std::string _path;
+
+    /** @brief _sync : durability of the current segment
+     */
+    file_sync _sync;
+
+    /** @brief _index : sidecar index of the current segment, deleted
+     *  @brief with it, if _index_interval is not 0
+     */
+    log_index_writer _index;
+    uint64_t _index_interval;
+};
+
+/**
+ * @brief Implementation to write a binary file (see log_binary.hpp):
+ * @brief the literal messages (see log_record) are written once in a
+ * @brief string table, the lines only refer to them. The log_decode
+ * @brief tool print the file as text
+ */
+class binary_file_log_policy : public log_policy_interface
+{
+public:
+    binary_file_log_policy();
+    ~binary_file_log_policy();
+    void open_out_stream(const std::string& name);
+    void close_out_stream();
+    void write(const std::string& msg);
+    void write_record(const log_record& record);
+    void flush();
+    bool accept_literals() const { return true; }
+private:
+    /** @brief string_id() id of a literal, added to the table (and
+     *  @brief written) the first time. Literals have static storage,
+     *  @brief so the address identify the text
+     */
+    uint32_t string_id(const char* literal);
+
+    void write_entry(const log_binary_entry& entry, const char* text);
+
+    std::ofstream _out_stream;
+    std::unordered_map<const char*, uint32_t> _string_ids;
+};
+
+/**
+ * @brief STDOUT_BLOCK_SIZE output buffer when the fd is not a terminal
+ * @brief STDOUT_FLUSH_MS max time a line stay in this buffer
+ */
+#define STDOUT_BLOCK_SIZE   65536
+#define STDOUT_FLUSH_MS     100
+
+/**
+ * @brief color of the lines of stdout_log_policy
+ * @param never no escape sequence
+ * @param always ANSI colors by log_level
+ * @param tty ANSI colors if the fd is a terminal
+ */
+enum class color_mode
+{
+    never = 1,
+    always,
+    tty
+};
+
+/**
+ * @brief Implementation log to stdout, or to another fd (i.e. stderr),
+ * @brief with raw write() of batches, without iostream. On a terminal
+ * @brief the lines are written after each batch of the daemon (line
+ * @brief buffered), otherwise (pipe, file) they are written by blocks
+ * @brief of STDOUT_BLOCK_SIZE, or after STDOUT_FLUSH_MS. The color
+ * @brief escape sequences are rendered once, in the constructor
  */
 class stdout_log_policy : public log_policy_interface
 {
 public:
-    stdout_log_policy() {  }
-    ~stdout_log_policy() {  }
+    /** @param fd file descriptor, not closed by the policy
+     *  @param color see color_mode enum
+     */
+    stdout_log_policy(int fd = 1, color_mode color = color_mode::never);
+    ~stdout_log_policy();
     void open_out_stream(const std::string& name){(void) name;}
-    void close_out_stream() {  }
+    void close_out_stream();
     void write(const std::string& msg);
+    void write_record(const log_record& record);
+    void write_view(const log_record_view& record);
+    bool accept_views() const { return true; }
+    void flush();
+    void sync();
+private:
+    /** @brief write_buffer() write the whole buffer to the fd
+     */
+    void write_buffer();
+
+    int _fd;
+    bool _tty;
+    std::string _buffer;
+    int64_t _last_write;
+
+    /** @brief _colors : escape sequence by log_level, empty if
+     *  @brief no color. _reset : end of the color, before '\n'
+     */
+    std::string _colors[(int)log_level::critical + 1];
+    std::string _reset;
+};
+
+/**
+ * @brief Implementation to write in a POSIX shared memory ring buffer,
+ * @brief read by a collector process (see shm_ring.hpp and the
+ * @brief shm_log_reader tool). No file or socket I/O on the logger side,
+ * @brief a collector too slow lose lines, it is never waited for.
+ */
+class shm_log_policy : public log_policy_interface
+{
+public:
+    /** @param capacity ring size in byte, rounded up to a power of 2
+     *  @param unlink_on_close remove the shm name when the logger is
+     *          destroyed (otherwise the collector could read it later)
+     */
+    shm_log_policy(uint64_t capacity = 1048576, bool unlink_on_close = false);
+    ~shm_log_policy();
+
+    /** @brief open_out_stream()
+     *  @brief the shm name is "/" followed by the logger name
+     *  @brief without path, i.e. "/execution.log"
+     */
+    void open_out_stream(const std::string& name);
+    void close_out_stream();
+    void write(const std::string& msg);
+private:
+    shm_ring_writer _ring;
+
+    /** @brief _capacity : size of the ring in byte
+     */
+    uint64_t _capacity;
+
+    /** @brief _unlink_on_close : remove the name on close
+     */
+    bool _unlink_on_close;
+};
+
+/**
+ * @brief UNIX_SOCKET_BATCH max datagrams sent by one sendmmsg call
+ * @brief UNIX_SOCKET_RETRY_MS delay between 2 connection attempts
+ */
+#define UNIX_SOCKET_BATCH       64
+#define UNIX_SOCKET_RETRY_MS    1000
+
+/**
+ * @brief Implementation to send each line as a datagram on a unix
+ * @brief domain socket (i.e. a local log daemon). Lines are buffered
+ * @brief and sent by batches (sendmmsg) when the daemon flush the
+ * @brief policy. The socket is non blocking: if the daemon is down
+ * @brief or slow, lines are kept (up to max_pending, then the oldest
+ * @brief are dropped and counted) and the connection is retried every
+ * @brief UNIX_SOCKET_RETRY_MS, the logger thread is never blocked.
+ */
+class unix_socket_log_policy : public log_policy_interface
+{
+public:
+    /** @param socket_path path of the listening socket
+     *  @param max_pending max lines kept while the daemon is not reachable
+     */
+    unix_socket_log_policy(const std::string& socket_path = "/dev/log",
+                            size_t max_pending = 10000);
+    ~unix_socket_log_policy();
+    void open_out_stream(const std::string& name);
+    void close_out_stream();
+    void write(const std::string& msg);
+    void write_record(const log_record& record);
+    void flush();
+
+protected:
+    /** @brief format() build the datagram of a record
+     *  @brief the default is the line itself, without the final '\n'
+     */
+    virtual void format(const log_record& record, std::string& datagram);
+
+    /** @brief _name : logger name without the path
+     */
+    std::string _name;
+
+private:
+    /** @brief connect_socket() non blocking connection attempt
+     *  @return true if connected
+     */
+    bool connect_socket();
+    void disconnect_socket();
+
+    /** @brief _socket_path : path of the daemon socket
+     */
+    std::string _socket_path;
+
+    /** @brief _fd : socket, -1 if not connected
+     */
+    int _fd;
+
+    /** @brief _next_retry : steady clock time (ms) of next connection
+     */
+    int64_t _next_retry;
+
+    /** @brief _pending : datagrams not sent yet
+     */
+    std::deque<std::string> _pending;
+    size_t _max_pending;
+
+    /** @brief _dropped : lines dropped since last successful send
+     */
+    uint64_t _dropped;
+};
+
+/**
+ * @brief unix_socket_log_policy sending RFC5424 syslog messages,
+ * @brief log_level is mapped to syslog severity (debug = 7 ...
+ * @brief critical = 2). The header pattern of the logger is still
+ * @brief in the MSG part, you may want to set a lighter one.
+ */
+class syslog_log_policy : public unix_socket_log_policy
+{
+public:
+    /** @param socket_path path of the syslog daemon socket
+     *  @param facility syslog facility number (1 = user, 16 = local0 ...)
+     *  @param app_name APP-NAME field, logger name if empty
+     *  @param max_pending max lines kept while the daemon is not reachable
+     */
+    syslog_log_policy(const std::string& socket_path = "/dev/log",
+                        unsigned int facility = 1,
+                        const std::string& app_name = "",
+                        size_t max_pending = 10000);
+    void open_out_stream(const std::string& name);
+
+protected:
+    void format(const log_record& record, std::string& datagram);
+
+private:
+    unsigned int _facility;
+    std::string _app_name;
+    std::string _hostname;
+    std::string _procid;
+};
+
+/**
+ * @brief FLIGHT_RECORDER_SUFFIX appended to the logger name for the
+ * @brief dump file, so that it can be spread with a file policy
+ */
+#define FLIGHT_RECORDER_SUFFIX ".flight"
+
+/**
+ * @brief Implementation keeping the last lines in memory, whatever
+ * @brief their level, without writing them anywhere. The whole window
+ * @brief is appended to the dump file when a line at dump_level or
+ * @brief above is logged, or on demand (dump()), then cleared.
+ * @brief The ring is only used by the logger thread, a dump requested
+ * @brief by another thread is done on the next flush (LOGGER_DELAY).
+ * @brief Records are length prefixed, the oldest are overwritten.
+ */
+class flight_recorder_log_policy : public log_policy_interface
+{
+public:
+    /** @param capacity size of the window in byte
+     *  @param dump_level lines at this level or above trigger a dump
+     */
+    flight_recorder_log_policy(size_t capacity = 4194304,
+                            log_level dump_level = log_level::error);
+    void open_out_stream(const std::string& name);
+    void close_out_stream();
+    void write(const std::string& msg);
+    void write_record(const log_record& record);
+    void flush();
+
+    /** @brief dump() request a dump of the window, thread safe
+     */
+    void dump();
+
+    /** @brief get_dump_count()
+     *  @return count of dumps written
+     */
+    uint64_t get_dump_count() const;
+
+private:
+    /** @brief store() copy a line in the ring, evicting the oldest
+     */
+    void store(const std::string& line);
+
+    /** @brief dump_window() append the window to the dump file,
+     *  @brief and clear it
+     */
+    void dump_window(const char* reason);
+
+    /** @brief copy_in() / copy_out() copy at an absolute position
+     *  @brief of the ring, wrapping at the end
+     */
+    void copy_in(uint64_t pos, const void* data, size_t len);
+    void copy_out(uint64_t pos, void* data, size_t len) const;
+
+    std::vector<char> _ring;
+
+    /** @brief _head absolute position of the oldest record
+     *  @brief _tail absolute position of the next record
+     */
+    uint64_t _head;
+    uint64_t _tail;
+    uint64_t _lines;
+
+    log_level _dump_level;
+    std::string _filename;
+
+    std::atomic<bool> _dump_requested;
+    std::atomic<uint64_t> _dumps;
 };
 
 /** 
@@ -230,6 +996,18 @@ public:
     void open_out_stream(const std::string& name);
     void close_out_stream();
     void write(const std::string& msg);
+    void write_record(const log_record& record);
+    void write_view(const log_record_view& record);
+    void flush();
+    void sync();
+
+    /** @brief accept_literals() only if all the policies do
+     */
+    bool accept_literals() const;
+
+    /** @brief accept_views() only if all the policies do
+     */
+    bool accept_views() const;
 private:
     /** @brief initailize() is
      *  @brief the recursive variadic method
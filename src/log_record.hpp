@@ -0,0 +1,101 @@
+#pragma once
+/*
+ * log_record.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+class log_span_site;
+
+/**
+ * @brief log level definition
+ * @brief macro defined to ease logger print call
+ * @param debug debug message
+ * @param info information (ex startup a service)
+ * @param notice Nothing serious, but notably nevertheless
+ * @param warning Nothing serious by itself but might indicate problems
+ * @param error Error condition
+ * @param critical Critical condition, should stop or abord
+ */
+enum class log_level
+{
+    debug = 1,
+    info,
+    notice,
+    warning,
+    error,
+    critical      //6
+};
+
+/**
+ * @brief log_record is what the logger queue and give to the policy:
+ * @brief the formatted line (header included, ending with '\n')
+ * @brief and the informations a policy may need about it. The
+ * @brief timestamp is converted with log_clock::to_realtime_ns
+ * @brief If literal is set, the message text (a string with static
+ * @brief storage) is not copied in line: it belong at literal_offset.
+ * @brief The daemon insert it (log_record_expand) unless the policy
+ * @brief accept literals (see log_policy_interface::accept_literals)
+ * @brief If span is set, the record is the span of a LOG_SCOPE_TIMER,
+ * @brief without line: the daemon aggregate it, it never reach a policy
+ */
+struct log_record
+{
+    log_level level;
+    std::string line;
+    uint64_t timestamp = 0;     // log_clock ticks, 0 if unknown
+    uint64_t sequence = 0;      // line number (%i), 0 if unknown
+    const char* literal = nullptr;
+    uint32_t literal_offset = 0;
+    const log_span_site* span = nullptr;
+    uint64_t duration = 0;      // log_clock ticks of the span
+};
+
+/** @brief log_record_expand() insert the literal in the line
+ */
+inline void log_record_expand(log_record& record)
+{
+    if (record.literal) {
+        record.line.insert(record.literal_offset, record.literal);
+        record.literal = nullptr;
+    }
+}
+
+/**
+ * @brief log_record_view is a log_record read in place in the queue of
+ * @brief the logger (see record_ring), given to the policies that
+ * @brief accept views (see log_policy_interface::accept_views). The
+ * @brief line is only valid during the call
+ */
+struct log_record_view
+{
+    log_record_view() = default;
+    log_record_view(const log_record& record):
+        level(record.level), line(record.line), timestamp(record.timestamp),
+        sequence(record.sequence), literal(record.literal),
+        literal_offset(record.literal_offset), span(record.span),
+        duration(record.duration) { }
+
+    log_level level = log_level::debug;
+    std::string_view line;
+    uint64_t timestamp = 0;
+    uint64_t sequence = 0;
+    const char* literal = nullptr;
+    uint32_t literal_offset = 0;
+    const log_span_site* span = nullptr;
+    uint64_t duration = 0;
+};
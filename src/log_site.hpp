@@ -0,0 +1,130 @@
+#pragma once
+/*
+ * log_site.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * @brief LOG_SITE_HERE expand to a pointer on the static log_site
+ * @brief object of the call site. Each expansion create its own lambda
+ * @brief so its own static object, capturing file and line.
+ */
+#define LOG_SITE_HERE ([]() -> log_site* {                     \
+            static log_site site(__FILE__, __LINE__);           \
+            return &site; }())
+
+/**
+ * @brief LOG_SITE_CATEGORY same as LOG_SITE_HERE, for a call site
+ * @brief of a category, i.e. "net.http" (shall be a string literal)
+ */
+#define LOG_SITE_CATEGORY(category) ([]() -> log_site* {       \
+            static log_site site(__FILE__, __LINE__, category); \
+            return &site; }())
+
+/**
+ * @brief log_site is the state attached to each LOG_* call site.
+ * @brief It stores where the call come from (file/line, category), the
+ * @brief token bucket used to rate limit the messages of this call site,
+ * @brief and the level of its category cached by the logger.
+ * @brief Constructor is constexpr so that static objects are constant
+ * @brief initialized (no guard on the hot path).
+ */
+class log_site
+{
+public:
+    constexpr log_site(const char* file, unsigned int line,
+                       const char* category = "")
+        : _file(file), _line(line), _category(category),
+          _tat(0), _suppressed(0), _level_cache(0) { }
+
+    log_site(const log_site&) = delete;
+    log_site& operator=(const log_site&) = delete;
+
+    /** @brief admit() take one token from the bucket
+     *  @brief The bucket is implemented as a theoretical arrival time
+     *  @brief (GCRA), so that it fits in one atomic and is lock free
+     *  @param now_ns current time in ns (steady clock)
+     *  @param interval_ns time required to regenerate one token
+     *  @param burst_ns tolerance, i.e. (bucket size - 1) * interval_ns
+     *  @return true if a token was available, false otherwise
+     */
+    bool admit(int64_t now_ns, int64_t interval_ns, int64_t burst_ns) {
+        int64_t tat = _tat.load(std::memory_order_relaxed);
+        int64_t next;
+        do {
+            int64_t base = tat > now_ns ? tat : now_ns;
+            if (base - now_ns > burst_ns)
+                return false;   // bucket is empty
+            next = base + interval_ns;
+        } while (!_tat.compare_exchange_weak(tat, next,
+                                            std::memory_order_relaxed));
+        return true;
+    }
+
+    /** @brief suppress() count a message that has been dropped
+     */
+    void suppress() {
+        _suppressed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** @brief take_suppressed()
+     *  @return the count of dropped messages since last call, and reset it
+     */
+    uint64_t take_suppressed() {
+        if (_suppressed.load(std::memory_order_relaxed) == 0)
+            return 0;
+        return _suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+    /** @brief level_cache() level of the category, as resolved by the
+     *  @brief logger, tagged with the logger and the generation of the
+     *  @brief levels (see logger::set_category_level). 0 if not resolved
+     */
+    uint64_t level_cache() const {
+        return _level_cache.load(std::memory_order_relaxed);
+    }
+    void set_level_cache(uint64_t cache) {
+        _level_cache.store(cache, std::memory_order_relaxed);
+    }
+
+    const char* file() const { return _file; }
+    unsigned int line() const { return _line; }
+    const char* category() const { return _category; }
+
+    /** @brief now_ns() time base used for the token bucket
+     */
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    const char* _file;
+    unsigned int _line;
+    const char* _category;
+
+    /** @brief _tat theoretical arrival time of the next message
+     */
+    std::atomic<int64_t> _tat;
+
+    /** @brief _suppressed messages dropped since last logged one
+     */
+    std::atomic<uint64_t> _suppressed;
+
+    std::atomic<uint64_t> _level_cache;
+};
@@ -0,0 +1,105 @@
+/*
+ * log_span.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "log_span.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#define LOG_SPAN_SUB_COUNT  (1 << LOG_SPAN_SUB_BITS)
+
+/* Values below LOG_SPAN_SUB_COUNT have their own bucket, then each
+ * power of 2 is split in LOG_SPAN_SUB_COUNT buckets */
+static unsigned int bucket_index(uint64_t ns)
+{
+    if (ns < LOG_SPAN_SUB_COUNT)
+        return ns;
+    unsigned int shift = 63 - __builtin_clzll(ns) - LOG_SPAN_SUB_BITS;
+    return ((shift + 1) << LOG_SPAN_SUB_BITS) +
+                ((ns >> shift) & (LOG_SPAN_SUB_COUNT - 1));
+}
+
+static uint64_t bucket_upper(unsigned int index)
+{
+    if (index < LOG_SPAN_SUB_COUNT)
+        return index;
+    unsigned int shift = (index >> LOG_SPAN_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)((index & (LOG_SPAN_SUB_COUNT - 1)) |
+                                LOG_SPAN_SUB_COUNT) << shift;
+    return low + (((uint64_t)1 << shift) - 1);
+}
+
+static void append_duration(std::string& line, uint64_t ns)
+{
+    char str[32];
+
+    if (ns < 1000)
+        snprintf(str, sizeof(str), "%uns", (unsigned int)ns);
+    else if (ns < 1000000)
+        snprintf(str, sizeof(str), "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(str, sizeof(str), "%.1fms", ns / 1e6);
+    else
+        snprintf(str, sizeof(str), "%.2fs", ns / 1e9);
+    line.append(str);
+}
+
+void log_span_histogram::add(uint64_t ns)
+{
+    _buckets[bucket_index(ns)]++;
+    _count++;
+    _sum += ns;
+    if (ns > _max)
+        _max = ns;
+}
+
+void log_span_histogram::reset()
+{
+    memset(_buckets, 0, sizeof(_buckets));
+    _count = 0;
+    _sum = 0;
+    _max = 0;
+}
+
+uint64_t log_span_histogram::percentile(double q) const
+{
+    // Rank of the duration, 1 based
+    uint64_t rank = (uint64_t)(q * _count + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < LOG_SPAN_BUCKETS; i++) {
+        seen += _buckets[i];
+        if (seen >= rank)
+            return bucket_upper(i) < _max ? bucket_upper(i) : _max;
+    }
+    return _max;
+}
+
+void log_span_histogram::report(std::string& line) const
+{
+    line.append("count ");
+    line.append(std::to_string(_count));
+    line.append(", p50 ");
+    append_duration(line, percentile(0.5));
+    line.append(", p99 ");
+    append_duration(line, percentile(0.99));
+    line.append(", max ");
+    append_duration(line, _max);
+    line.append(", mean ");
+    append_duration(line, mean());
+}
@@ -0,0 +1,94 @@
+#pragma once
+/*
+ * log_span.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief LOG_SPAN_SITE expand to a pointer on the static log_span_site
+ * @brief of the call site, like LOG_SITE_HERE. name shall be a string
+ * @brief literal, i.e. "db.query"
+ */
+#define LOG_SPAN_SITE(name) ([]() -> log_span_site* {              \
+            static log_span_site site(name, __FILE__, __LINE__);    \
+            return &site; }())
+
+/**
+ * @brief log_span_site is the call site of a LOG_SCOPE_TIMER: its name
+ * @brief and where it is. The spans carry a pointer on it, the daemon
+ * @brief aggregate them by site (see log_span_histogram)
+ */
+class log_span_site
+{
+public:
+    constexpr log_span_site(const char* name, const char* file,
+                            unsigned int line)
+        : _name(name), _file(file), _line(line) { }
+
+    log_span_site(const log_span_site&) = delete;
+    log_span_site& operator=(const log_span_site&) = delete;
+
+    const char* name() const { return _name; }
+    const char* file() const { return _file; }
+    unsigned int line() const { return _line; }
+
+private:
+    const char* _name;
+    const char* _file;
+    unsigned int _line;
+};
+
+/**
+ * @brief LOG_SPAN_SUB_BITS the buckets of a power of 2 are split in
+ * @brief 2^LOG_SPAN_SUB_BITS, i.e. a percentile is known within 12.5%
+ */
+#define LOG_SPAN_SUB_BITS   3
+#define LOG_SPAN_BUCKETS    ((64 - LOG_SPAN_SUB_BITS + 1) << LOG_SPAN_SUB_BITS)
+
+/**
+ * @brief log_span_histogram the durations of a site in ns, in log-linear
+ * @brief buckets: fixed size, add() is a few instructions and never
+ * @brief allocate. The max and the mean are exact
+ */
+class log_span_histogram
+{
+public:
+    log_span_histogram() { reset(); }
+
+    void add(uint64_t ns);
+    void reset();
+
+    uint64_t count() const { return _count; }
+    uint64_t max() const { return _max; }
+    uint64_t mean() const { return _count ? _sum / _count : 0; }
+
+    /** @brief percentile() upper bound of the bucket holding the
+     *  @brief fraction q (0 to 1) of the durations, at most max()
+     */
+    uint64_t percentile(double q) const;
+
+    /** @brief report() append "count N, p50 .., p99 .., max .., mean .." with
+     *  @brief the durations in a readable unit (ns, us, ms or s)
+     */
+    void report(std::string& line) const;
+
+private:
+    uint64_t _buckets[LOG_SPAN_BUCKETS];
+    uint64_t _count;
+    uint64_t _sum;
+    uint64_t _max;
+};
@@ -15,35 +15,334 @@
  */
 
 #include "logger.hpp"
-#include <iomanip>
+#include "cpu_topology.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <fstream>
 #include <chrono>
+#include <ctime>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <execinfo.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /*
 * Thread functions
 */
-void logger::logging_thread()
+void logger::logging_thread(backend* back, std::vector<int> cpus)
 {
-    std::unique_lock< std::mutex > writing_lock(_write_mutex ,std::defer_lock );
-    std::string log_line;
+    std::unique_lock< std::mutex > writing_lock(back->write_mutex ,std::defer_lock );
+    std::vector< std::promise<void> > waiters;
+    std::vector< std::function<void()> > flushed;
+    std::vector< std::function<void()> > space;
+    bool running;
+    bool taken;
+    bool reported = false;
+
+    // The thread is bound before any allocation
+    if (!cpus.empty())
+        pin_thread(pthread_self(), cpus);
+    if (back->node >= 0)
+        prefer_numa_node(back->node);
+
     do{
         writing_lock.lock();  // shall be locked before wait call
-        _data_available.wait_for(writing_lock,
+        back->data_available.wait_for(writing_lock,
                 std::chrono::milliseconds(LOGGER_DELAY),
-               [this]{ return (!_log_buffer.empty() || !_is_running.load()); });
+               [this, back]{ return (back->queued > 0 ||
+                                !back->sync_waiters.empty() ||
+                                !back->flush_waiters.empty() ||
+                                !back->running.load()); });
 
-        if( !_log_buffer.empty() ) {
-            
-            log_line = std::move(_log_buffer.front());
-            _log_buffer.pop();
-            writing_lock.unlock();
+        // Take the whole queue at once, producers are not blocked
+        // while the batch is written: the ring is read up to tail,
+        // they push after it. Waiters lines are all in this batch or
+        // in a previous one
+        running = back->running.load();
+        uint64_t tail = back->ring.tail();
+        taken = back->queued > 0;
+        back->writing.swap(back->log_buffer);
+        back->queued = 0;
+        waiters.swap(back->sync_waiters);
+        flushed.swap(back->flush_waiters);
 
-            _policy->write( log_line );
-            log_line.clear();
-        } else
-            writing_lock.unlock();
+        // The queue is empty, let in as many lines as the limit
+        size_t limit = _async_queue_limit.load(std::memory_order_relaxed);
+        while (!back->space_waiters.empty() &&
+                    (limit == 0 || space.size() < limit)) {
+            space.push_back(std::move(back->space_waiters.front()));
+            back->space_waiters.pop_front();
+        }
+        writing_lock.unlock();
+
+        for (auto& task : space)
+            resume(task);
+        space.clear();
+
+        {
+            std::scoped_lock<std::mutex> policy_lock(_policy_mutex);
+
+            bool literals = _policy->accept_literals();
+            bool views = _policy->accept_views();
+
+            // The overflow lines are newer than the ring ones
+            back->ring.for_each(back->ring.head(), tail,
+                    [this, literals, views, running](const log_record_view& record) {
+                        if (record.span)
+                            add_span(record);
+                        else if (!running && stop_expired())
+                            _dropped.fetch_add(1, std::memory_order_relaxed);
+                        else
+                            write_queued(record, literals, views);
+                    });
+            for (auto& record : back->writing) {
+                if (record.span) {
+                    add_span(record);
+                    continue;
+                }
+                if (!running && stop_expired()) {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (!literals)
+                    log_record_expand(record);
+                _policy->write_record( record );
+            }
+            _policy->flush();
+
+            // Group commit: one sync for all the waiters of the batch
+            if( !waiters.empty() )
+                _policy->sync();
+        }
+
+        for (auto& waiter : waiters)
+            waiter.set_value();
+        waiters.clear();
+        for (auto& task : flushed)
+            resume(task);
+        flushed.clear();
+
+        // Released once flushed, so that the crash handler still see
+        // lines that may be in the policy buffers
+        writing_lock.lock();
+        back->ring.release(tail);
+        writing_lock.unlock();
+        back->writing.clear();
+
+        if (back->first) {
+            check_config_watch();
+            log_clock::calibrate();
+            // The last report once the spans queued before the stop
+            // are taken, its lines need one more pass
+            if (running)
+                report_spans(false);
+            else if (!reported) {
+                reported = true;
+                taken |= report_spans(true);
+            }
+        }
+
+    // Once stopped, a last pass with an empty queue: every line queued
+    // before the stop is written. Until the deadline if lines keep coming
+    }while( running || (taken && !stop_expired()) );
+
+    {
+        std::scoped_lock<std::mutex> lock(_shutdown_mutex);
+        _daemons_running.fetch_sub(1);
+    }
+    _shutdown_cv.notify_all();
+}
+
+logger::backend_set* logger::make_backends(const std::vector<int>& nodes)
+{
+    backend_set* backends = new backend_set();
+
+    for (int node : nodes)
+        backends->push_back(std::make_unique<backend>(node, backends->empty()));
+    return backends;
+}
 
-    }while( _is_running.load() || !_log_buffer.empty());
-    //Dump the log data if any before shutting down
+void logger::start_backends(backend_set& backends)
+{
+    //Set the running flag and spawn the daemons
+    _is_running.store(true);
+    _daemons_running.fetch_add(backends.size());
+    for (auto& back : backends)
+        back->daemon = std::thread( &logger::logging_thread, this, back.get(),
+                                    daemon_cpus(back->node, _cpu_affinity) );
+}
+
+/* The lock is taken so that a daemon can't miss the notification
+ * between its predicate check and its wait (it would sleep LOGGER_DELAY)
+ */
+static void stop_daemon(std::atomic<bool>& running, std::mutex& write_mutex,
+                        std::condition_variable& data_available)
+{
+    running.store(false);
+    { std::scoped_lock<std::mutex> lock(write_mutex); }
+    data_available.notify_one();
+}
+
+void logger::stop_backends(backend_set* backends)
+{
+    if (!backends) {
+        request_stop(0);
+        backends = _backends.load();
+    } else {
+        for (auto& back : *backends)
+            stop_daemon(back->running, back->write_mutex, back->data_available);
+    }
+    for (auto& back : *backends)
+        if (back->daemon.joinable())
+            back->daemon.join();
+}
+
+void logger::request_stop(int64_t deadline_ns)
+{
+    _stop_deadline.store(deadline_ns, std::memory_order_relaxed);
+    _is_running.store(false);
+
+    for (auto& back : *_backends.load())
+        stop_daemon(back->running, back->write_mutex, back->data_available);
+}
+
+static int64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool logger::stop_expired() const
+{
+    int64_t deadline = _stop_deadline.load(std::memory_order_relaxed);
+    return deadline != 0 && steady_ns() >= deadline;
+}
+
+void logger::restart_backends(const std::vector<int>& nodes)
+{
+    std::scoped_lock<std::mutex> lock(_placement_mutex);
+    backend_set* previous = _backends.exchange(make_backends(nodes));
+
+    // The producers queue in the new set meanwhile, its daemons are
+    // started once every line of the previous one is written, so the
+    // lines of a thread stay in order. The sync and flush waiters of
+    // the previous set are taken by its last pass, after their lines
+    // are written: only space waiters may be left
+    _grace.synchronize();
+    stop_backends(previous);
+    resume_waiters(previous);
+    delete previous;
+
+    start_backends(*_backends.load());
+}
+
+std::vector<int> logger::daemon_cpus(int node, const std::vector<int>& affinity)
+{
+    if (node < 0 || affinity.empty())
+        return node < 0 ? affinity : numa_node_cpus(node);
+
+    std::vector<int> cpus = numa_node_cpus(node);
+    std::vector<int> common;
+    for (int cpu : cpus)
+        if (std::find(affinity.begin(), affinity.end(), cpu) != affinity.end())
+            common.push_back(cpu);
+    return common.empty() ? cpus : common;
+}
+
+void logger::resume_waiters(backend_set* backends)
+{
+    if (!backends)
+        backends = _backends.load();
+    for (auto& back : *backends) {
+        std::vector< std::function<void()> > tasks;
+        {
+            std::scoped_lock<std::mutex> lock(back->write_mutex);
+            tasks.swap(back->flush_waiters);
+            std::move(back->space_waiters.begin(), back->space_waiters.end(),
+                                            std::back_inserter(tasks));
+            back->space_waiters.clear();
+        }
+        for (auto& task : tasks)
+            resume(task);
+    }
+}
+
+void logger::when_flushed(std::function<void()> task)
+{
+    if (!queue_flush_waiter(task))
+        resume(task);   // stopped, every line is written
+}
+
+/* The task is resumed by the caller, out of the reader section: run
+ * inline, it may call a setter, which wait for the readers to end */
+bool logger::queue_flush_waiter(std::function<void()>& task)
+{
+    log_grace::reader guard(_grace);
+    backend& back = local_backend();
+    {
+        // Taken by the daemon with the lines queued before. running is
+        // cleared before the lock is taken to stop the daemon, so if it
+        // is still set, its last pass will take the task
+        std::scoped_lock<std::mutex> lock(back.write_mutex);
+        if (!back.running.load())
+            return false;
+        back.flush_waiters.push_back(std::move(task));
+    }
+    back.data_available.notify_one();
+    return true;
+}
+
+bool logger::when_queue_space(std::function<void()> task)
+{
+    log_grace::reader guard(_grace);
+    backend& back = local_backend();
+    std::scoped_lock<std::mutex> lock(back.write_mutex);
+    size_t limit = _async_queue_limit.load(std::memory_order_relaxed);
+
+    // Never suspended once stopped, nobody would resume it
+    if (limit == 0 || back.queued < limit || !back.running.load())
+        return false;
+    back.space_waiters.push_back(std::move(task));
+    return true;
+}
+
+void logger::resume(std::function<void()>& task)
+{
+    log_executor* executor = _executor.load(std::memory_order_acquire);
+    if (executor)
+        executor->post(std::move(task));
+    else
+        task();
+}
+
+void logger::set_executor(log_executor* executor)
+{
+    _executor.store(executor, std::memory_order_release);
+}
+
+void logger::set_async_queue_limit(size_t max_lines)
+{
+    _async_queue_limit.store(max_lines, std::memory_order_relaxed);
+}
+
+logger::backend& logger::local_backend()
+{
+    backend_set& backends = *_backends.load(std::memory_order_acquire);
+    if (backends.size() == 1)
+        return *backends.front();
+
+    static thread_local int home_node = current_numa_node();
+    for (auto& back : backends)
+        if (back->node == home_node)
+            return *back;
+    return *backends[home_node % backends.size()];
 }
 
 /**
@@ -52,12 +351,64 @@ void logger::logging_thread()
 
 // static func
 logger* logger::_default_logger = nullptr;
-std::map<std::string, logger*> logger::_logger_list;
+std::map<std::string, logger*>& logger::_logger_list =
+                                    *new std::map<std::string, logger*>();
+std::mutex& logger::_registry_mutex = *new std::mutex();
+std::atomic<logger*> logger::_crash_slots[LOGGER_CRASH_SLOTS];
+int logger::_crash_fd = STDERR_FILENO;
+std::mutex& logger::_shutdown_mutex = *new std::mutex();
+std::condition_variable& logger::_shutdown_cv = *new std::condition_variable();
+std::atomic<int64_t> logger::_exit_timeout(LOGGER_SHUTDOWN_TIMEOUT);
+std::atomic<uint64_t> logger::_level_generation(1);
+std::atomic<uint64_t> logger::_next_id(0);
+
+/* strftime is used instead of std::put_time to avoid building
+ * a stream each time. 128 chars is enough for any sensible format
+ */
+struct time_text_cache
+{
+    time_t second = -1;
+    std::string format;
+    std::string text;
+};
+
+/* thread_state_gone is trivially destructible, so still readable once
+ * the thread_locals are destroyed: the main thread logs from the
+ * atexit handler (see install_exit_handler) after that */
+static thread_local bool thread_state_gone = false;
+
+/* State of the calling thread, kept from a line to the next */
+struct thread_state
+{
+    /* The string keep its capacity up to LOGGER_LINE_KEEP bytes */
+    std::string reused_line;
+    bool reused_line_busy = false;
+
+    /* Names of the thread, one per logger _id */
+    std::vector< std::pair<uint64_t, std::string> > names;
+
+    time_text_cache date;
+    time_text_cache time;
+
+    ~thread_state() { thread_state_gone = true; }
+};
+
+/* nullptr once destroyed, the callers use storage of their own then */
+static thread_state* local_thread_state()
+{
+    if (thread_state_gone)
+        return nullptr;
+    static thread_local thread_state state;
+    return &state;
+}
 
 logger* logger::get_default_logger()
 {
-    if (_default_logger)
-        return _default_logger;
+    {
+        std::scoped_lock<std::mutex> lock(_registry_mutex);
+        if (_default_logger)
+            return _default_logger;
+    }
     
     // if no default logger, map is empty
     // just build a defaut logger, it will be set
@@ -68,6 +419,7 @@ logger* logger::get_default_logger()
 }
 
 logger* logger::get_logger(const std::string& name) {
+    std::scoped_lock<std::mutex> lock(_registry_mutex);
     std::map<std::string, logger*>::iterator it;
     
     it = _logger_list.find(name);
@@ -78,6 +430,7 @@ logger* logger::get_logger(const std::string& name) {
 }
 
 bool logger::loggername_exist(const std::string& name) {
+    std::scoped_lock<std::mutex> lock(_registry_mutex);
      // Check if the same name exist
     for (auto const& lo : _logger_list)
     {
@@ -88,158 +441,932 @@ bool logger::loggername_exist(const std::string& name) {
 }
 
 void logger::logger_killall() {
-    // Copy the map because items will be 
+    shutdown_all(std::chrono::milliseconds(0));
+}
+
+bool logger::shutdown_all(std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    int64_t deadline_ns = timeout.count() > 0 ? steady_ns() + 
+            std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count() : 0;
+    bool complete = true;
+
+    // Copy the list because items will be 
     // deleted by the destructor
-     std::map<std::string, logger*> list_cpy(_logger_list);
-    for (auto const& lo : list_cpy)
-        delete (lo.second);
+    std::vector<logger*> loggers;
+    {
+        std::scoped_lock<std::mutex> lock(_registry_mutex);
+        for (auto const& lo : _logger_list)
+            loggers.push_back(lo.second);
+    }
+
+    // All the daemons drain their queue at once
+    for (logger* log : loggers) {
+        if (log->_is_running.load()) {
+            log->LOG_INFO( "..............Logger activity terminated.............." );
+            log->request_stop(deadline_ns);
+        }
+    }
+
+    auto all_stopped = [&loggers] {
+        for (logger* log : loggers)
+            if (log->_daemons_running.load() > 0)
+                return false;
+        return true;
+    };
+    {
+        std::unique_lock<std::mutex> lock(_shutdown_mutex);
+        if (deadline_ns)
+            _shutdown_cv.wait_until(lock, deadline, all_stopped);
+        else
+            _shutdown_cv.wait(lock, all_stopped);
+    }
+
+    for (logger* log : loggers) {
+        if (log->_dropped.load() > 0)
+            complete = false;
+        if (log->_daemons_running.load() == 0) {
+            delete log;     // the daemons are only joined
+            continue;
+        }
+
+        // Blocked in the policy: left alive, out of reach
+        complete = false;
+        for (auto& back : *log->_backends.load())
+            back->daemon.detach();
+        log->unregister();
+    }
+
+    return complete;
+}
+
+void logger::install_exit_handler(std::chrono::milliseconds timeout) {
+    static std::once_flag registered;
+
+    _exit_timeout.store(timeout.count());
+    std::call_once(registered, [] {
+        std::atexit(&logger::exit_handler);
+        std::at_quick_exit(&logger::exit_handler);
+    });
+}
+
+void logger::exit_handler() {
+    shutdown_all(std::chrono::milliseconds(_exit_timeout.load()));
 }
 
 // constructor
 
 logger::logger(log_policy_interface* policy,
-        const std::string& name): _policy(policy),
+        const std::string& name): _config(nullptr), _id(_next_id++),
+        _config_watch(-1),
+        _policy(policy),
+        _stop_deadline(0), _dropped(0), _daemons_running(0),
+        _executor(nullptr), _async_queue_limit(0),
+        _span_interval_ns(0), _span_target(nullptr),
+        _span_level(log_level::info), _span_last_report(0),
+        _site_interval_ns(0), _site_burst_ns(0),
         _log_line_number(0), _filename(name)
 {
     //remove the path for the logger name
     _name = _filename.substr(_filename.find_last_of("/\\") + 1);
-    
-    _min_log_level = log_level::debug;
-
-    if (_logger_list.empty())
-        set_default_logger();
 
-    _logger_list.insert(std::pair<std::string, logger*>(_filename, this));
-    set_pattern(DEFAULT_PATTERN);
-    _date_format = "%d-%m-%Y";
-    _time_format = "%H:%M:%S";
+    // First config snapshot, the setters copy it
+    auto conf = std::make_unique<config>();
+    parse_pattern(DEFAULT_PATTERN, *conf);
+    conf->min_log_level = log_level::debug;
+    conf->format = output_format::text;
+    conf->date_format = "%d-%m-%Y";
+    conf->time_format = "%H:%M:%S";
+    _config.store(conf.release(), std::memory_order_release);
+    _site_tag.store(next_site_tag(), std::memory_order_release);
 
     _policy->open_out_stream(_filename);
     // avoid logging start here because pattern is not set
 
-    //Set the running flag and spawn the daemon
-    _is_running.store(true);
-    _daemon = std::thread( &logger::logging_thread, this );
+    // Register in the first free crash slot (ignored if full)
+    for (auto& slot : _crash_slots) {
+        logger* expected = nullptr;
+        if (slot.compare_exchange_strong(expected, this))
+            break;
+    }
+
+    _backends.store(make_backends({ -1 }));
+    start_backends(*_backends.load());
+
+    // Listed once complete, other threads may look it up
+    std::scoped_lock<std::mutex> lock(_registry_mutex);
+    if (_logger_list.empty())
+        _default_logger = this;
+
+    _logger_list.insert(std::pair<std::string, logger*>(_filename, this));
 }
 
 // destructor
 
 logger::~logger()
 {
-    std::map<std::string, logger*>::iterator it;
-
+    unregister();
     terminate_logger();
 
-    // if the default_logger is deleted, reaffect to the 1st
-    if (_default_logger == this)
-        if(_logger_list.size() > 1)
-            _default_logger = _logger_list.begin()->second;
-        else
-            _default_logger = nullptr;
+    for (auto& slot : _crash_slots) {
+        logger* expected = this;
+        if (slot.compare_exchange_strong(expected, nullptr))
+            break;
+    }
 
-    it = _logger_list.find(_filename);
-    if (it != _logger_list.end())
-         _logger_list.erase (it);
+    if (_config_watch >= 0)
+        ::close(_config_watch);
 
     _policy->close_out_stream();
     delete _policy;
+    delete _backends.load();
+    delete _config.load();
 }
 
 void logger::set_default_logger()
 {
+    std::scoped_lock<std::mutex> lock(_registry_mutex);
     _default_logger = this;
 }
 
+void logger::unregister()
+{
+    std::scoped_lock<std::mutex> lock(_registry_mutex);
+    std::map<std::string, logger*>::iterator it;
+
+    // Another logger may have been built with the same name
+    it = _logger_list.find(_filename);
+    if (it != _logger_list.end() && it->second == this)
+         _logger_list.erase (it);
+
+    // if the default_logger is deleted, reaffect to the 1st
+    if (_default_logger == this)
+        _default_logger = _logger_list.empty() ? nullptr :
+                                        _logger_list.begin()->second;
+}
+
 void logger::terminate_logger()
 {
-    //Terminate the daemon activity
-    LOG_INFO( "..............Logger activity terminated.............." );
-    _is_running.store(false);
-    _daemon.join();
+    //Terminate the daemon activity, unless done by shutdown_all
+    if (_is_running.load())
+        LOG_INFO( "..............Logger activity terminated.............." );
+    stop_backends();
+    resume_waiters();
+}
+
+/* Everything used by the handler is allocated here, the handler
+ * itself only use write(), backtrace() and stack buffers
+ */
+bool logger::install_crash_handler(const std::string& filename)
+{
+    static char alt_stack[64 * 1024];
+    static void* frames[1];
+
+    if (!filename.empty()) {
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND |
+                                                O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        _crash_fd = fd;
+    }
+
+    // backtrace() load libgcc on first call, which is not signal safe
+    backtrace(frames, 1);
+
+    stack_t ss = {};
+    ss.ss_sp = alt_stack;
+    ss.ss_size = sizeof(alt_stack);
+    sigaltstack(&ss, nullptr);
+
+    struct sigaction sa = {};
+    sa.sa_handler = &logger::crash_handler;
+    sa.sa_flags = SA_ONSTACK | SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+
+    return sigaction(SIGSEGV, &sa, nullptr) == 0 &&
+           sigaction(SIGABRT, &sa, nullptr) == 0 &&
+           sigaction(SIGBUS, &sa, nullptr) == 0;
+}
+
+/* The queues are read without their lock: the thread that crashed
+ * may hold it. It's a best effort, done just before dying
+ */
+void logger::crash_handler(int sig)
+{
+    static void* frames[LOGGER_CRASH_FRAMES];
+    static volatile sig_atomic_t in_handler = 0;
+    char msg[128];
+    size_t len;
+
+    if (in_handler)     // crashed in the handler, SA_RESETHAND kill us
+        return;
+    in_handler = 1;
+
+    auto put = [](const char* str, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(_crash_fd, str, size);
+            if (n <= 0)
+                return;
+            str += n;
+            size -= n;
+        }
+    };
+    auto put_str = [&put](const char* str) { put(str, strlen(str)); };
+
+    // Signal number, without any printf
+    const char head[] = "\n*** logger: caught signal ";
+    len = sizeof(head) - 1;
+    memcpy(msg, head, len);
+    char digits[12];
+    int ndigits = 0;
+    for (unsigned int n = sig; n > 0 || ndigits == 0; n /= 10)
+        digits[ndigits++] = '0' + n % 10;
+    while (ndigits > 0)
+        msg[len++] = digits[--ndigits];
+    msg[len++] = ' ';
+    msg[len++] = '*';
+    msg[len++] = '*';
+    msg[len++] = '*';
+    msg[len++] = '\n';
+    put(msg, len);
+
+    for (auto& slot : _crash_slots) {
+        logger* log = slot.load(std::memory_order_acquire);
+        if (!log)
+            continue;
+        put_str("*** pending lines of ");
+        put(log->_name.data(), log->_name.size());
+        put_str(" ***\n");
+        auto put_record = [&put, &put_str](const log_record_view& record) {
+            if (!record.literal) {
+                put(record.line.data(), record.line.size());
+                return;
+            }
+            size_t offset = std::min<size_t>(record.literal_offset,
+                                             record.line.size());
+            put(record.line.data(), offset);
+            put_str(record.literal);
+            put(record.line.data() + offset, record.line.size() - offset);
+        };
+        for (const auto& back : *log->_backends.load()) {
+            back->ring.for_each(back->ring.head(), back->ring.tail(), put_record);
+            for (const auto& record : back->writing)
+                put_record(record);
+            for (const auto& record : back->log_buffer)
+                put_record(record);
+        }
+    }
+
+    put_str("*** backtrace ***\n");
+    int depth = backtrace(frames, LOGGER_CRASH_FRAMES);
+    backtrace_symbols_fd(frames, depth, _crash_fd);
+
+    raise(sig);     // default action, restored by SA_RESETHAND
 }
 
 void logger::set_thread_name(const std::string& name)
 {
-    _thread_name[ std::this_thread::get_id() ] = name;
+    thread_state* state = local_thread_state();
+    if (!state)
+        return;     // the thread is exiting
+
+    for (auto& entry : state->names)
+        if (entry.first == _id) {
+            entry.second = name;
+            return;
+        }
+    state->names.emplace_back(_id, name);
+}
+
+const std::string& logger::thread_name()
+{
+    // Never destroyed, it may be returned from an atexit handler
+    static const std::string& unnamed = *new std::string();
+    thread_state* state = local_thread_state();
+    if (!state)
+        return unnamed;
+
+    for (const auto& entry : state->names)
+        if (entry.first == _id)
+            return entry.second;
+    return unnamed;
 }
 
 void logger::set_min_log_level(log_level new_level)
 {
-    _min_log_level = new_level;
+    update_config([new_level](config& conf) { conf.min_log_level = new_level; });
+}
+
+void logger::set_rate_limit(unsigned int max_per_second, unsigned int burst)
+{
+    if (max_per_second == 0) {
+        _site_interval_ns.store(0, std::memory_order_relaxed);
+        return;
+    }
+    if (burst == 0)
+        burst = 1;
+
+    int64_t interval = 1000000000LL / max_per_second;
+    if (interval == 0)
+        interval = 1;
+    _site_burst_ns.store(interval * (burst - 1), std::memory_order_relaxed);
+    _site_interval_ns.store(interval, std::memory_order_relaxed);
+}
+
+void logger::set_span_report(std::chrono::milliseconds interval,
+                             logger* target, log_level level)
+{
+    _span_target.store(target, std::memory_order_relaxed);
+    _span_level.store(level, std::memory_order_relaxed);
+    {
+        std::scoped_lock<std::mutex> lock(_policy_mutex);
+        _span_last_report = steady_ns();
+    }
+    _span_interval_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    interval).count(), std::memory_order_relaxed);
+}
+
+void logger::push_span(const log_span_site* site, uint64_t start, uint64_t end)
+{
+    log_grace::reader guard(_grace);
+    backend& back = local_backend();
+    log_record_view record;
+
+    record.timestamp = start;
+    record.span = site;
+    record.duration = end - start;
+
+    std::scoped_lock<std::mutex> lock(back.write_mutex);
+    if (!back.log_buffer.empty() || !back.ring.push(record))
+        back.log_buffer.push_back(log_record{ log_level::debug, std::string(),
+                                    start, 0, nullptr, 0, site, end - start });
+    back.queued++;
+    // No notification, a futex wake per span would cost more than
+    // the span itself
+}
+
+void logger::add_span(const log_record_view& record)
+{
+    _spans[record.span].add(log_clock::duration_ns(record.duration));
+}
+
+bool logger::report_spans(bool force)
+{
+    int64_t interval = _span_interval_ns.load(std::memory_order_relaxed);
+    int64_t now = steady_ns();
+    std::vector<std::string> lines;
+
+    if (interval == 0)
+        return false;
+    {
+        std::scoped_lock<std::mutex> lock(_policy_mutex);
+        if (!force && now - _span_last_report < interval)
+            return false;
+        _span_last_report = now;
+
+        for (auto& span : _spans) {
+            if (span.second.count() == 0)
+                continue;
+            std::string line("span ");
+            line.append(span.first->name());
+            line.push_back(' ');
+            span.second.report(line);
+            line.append(" (");
+            line.append(span.first->file());
+            line.push_back(':');
+            line.append(std::to_string(span.first->line()));
+            line.push_back(')');
+            lines.push_back(std::move(line));
+            span.second.reset();
+        }
+    }
+    std::sort(lines.begin(), lines.end());
+
+    // Printed without the policy lock, the target may be this logger
+    // A target stopped meanwhile (shutdown_all) would not write them
+    logger* target = _span_target.load(std::memory_order_relaxed);
+    if (!target || !target->_is_running.load())
+        target = this;
+    log_level level = _span_level.load(std::memory_order_relaxed);
+    for (auto& line : lines)
+        target->print(level, line);
+    return target == this && !lines.empty();
 }
 
-void logger::print_impl(std::stringstream&& log_stream)
+bool logger::set_cpu_affinity(const std::vector<int>& cpus)
 {
-    if(!log_stream.str().empty()) {
-        if(log_stream.str().back() != '\n')
-            log_stream << std::endl;
+    std::scoped_lock<std::mutex> lock(_placement_mutex);
 
-        std::scoped_lock<std::mutex> lock(_write_mutex);
-        std::string todel(log_stream.str());
-        _log_buffer.push(log_stream.str());
+    // An invalid set is not kept, the daemons go back to the previous one
+    for (auto& back : *_backends.load()) {
+        if (!pin_thread(back->daemon.native_handle(),
+                        daemon_cpus(back->node, cpus))) {
+            for (auto& pinned : *_backends.load())
+                pin_thread(pinned->daemon.native_handle(),
+                           daemon_cpus(pinned->node, _cpu_affinity));
+            return false;
+        }
     }
-    _data_available.notify_one();
+    _cpu_affinity = cpus;
+    return true;
+}
+
+bool logger::set_numa_node(int node)
+{
+    if (node < 0 || node >= numa_node_count() || numa_node_cpus(node).empty())
+        return false;
+
+    restart_backends({ node });
+    return true;
+}
+
+int logger::set_numa_backends()
+{
+    std::vector<int> nodes;
+
+    for (int node = 0; node < numa_node_count(); node++)
+        if (!numa_node_cpus(node).empty())  // memory only nodes
+            nodes.push_back(node);
+    if (nodes.empty())
+        nodes.push_back(-1);
+
+    restart_backends(nodes);
+    return nodes.size();
+}
+
+void logger::print_impl(const header_fields& fields, std::string& line,
+                        const char* literal, size_t literal_offset)
+{
+    // The literal is the end of the line if nothing follow it
+    if (literal && literal_offset == line.size() && *literal) {
+        if (literal[strlen(literal) - 1] != '\n')
+            line.push_back('\n');
+        push_line(fields, line, literal, literal_offset);
+    } else if(!line.empty()) {
+        if(line.back() != '\n')
+            line.push_back('\n');
+
+        push_line(fields, line, literal, literal_offset);
+    } else
+        local_backend().data_available.notify_one();
+}
+
+void logger::push_line(const header_fields& fields, std::string_view line,
+                       const char* literal, size_t literal_offset)
+{
+    backend& back = local_backend();
+    log_record_view record;
+
+    record.level = fields.level;
+    record.line = line;
+    record.timestamp = fields.timestamp;
+    record.sequence = fields.line_number;
+    record.literal = literal;
+    record.literal_offset = literal_offset;
+    {
+        std::scoped_lock<std::mutex> lock(back.write_mutex);
+        // Once a line overflow, the next ones follow it until the
+        // daemon take them, so that the order is kept
+        if (!back.log_buffer.empty() || !back.ring.push(record))
+            back.log_buffer.push_back(log_record{ fields.level,
+                                    std::string(line), fields.timestamp,
+                                    fields.line_number, literal,
+                                    (uint32_t)literal_offset });
+        back.queued++;
+    }
+    back.data_available.notify_one();
+}
+
+void logger::write_queued(const log_record_view& record, bool literals,
+                          bool views)
+{
+    if (views && (literals || !record.literal)) {
+        _policy->write_view(record);
+        return;
+    }
+
+    _scratch.level = record.level;
+    _scratch.line.assign(record.line);
+    _scratch.timestamp = record.timestamp;
+    _scratch.sequence = record.sequence;
+    _scratch.literal = record.literal;
+    _scratch.literal_offset = record.literal_offset;
+    if (!literals)
+        log_record_expand(_scratch);
+
+    if (views)
+        _policy->write_view(_scratch);
+    else
+        _policy->write_record(_scratch);
+}
+
+logger::line_buffer::line_buffer()
+{
+    thread_state* state = local_thread_state();
+
+    _reused = state && !state->reused_line_busy;
+    if (_reused) {
+        state->reused_line_busy = true;
+        state->reused_line.clear();
+        _line = &state->reused_line;
+    } else {
+        _line = &_own;
+    }
+}
+
+logger::line_buffer::~line_buffer()
+{
+    if (!_reused)
+        return;
+
+    // Still alive: it was when the buffer was taken, in the same thread
+    thread_state* state = local_thread_state();
+    if (state->reused_line.capacity() > LOGGER_LINE_KEEP) {
+        state->reused_line.clear();
+        state->reused_line.shrink_to_fit();
+    }
+    state->reused_line_busy = false;
+}
+
+void logger::json_header(std::string& line, const header_fields& fields)
+{
+    json_writer json(line);
+    char ts[48];
+    int64_t ns = log_clock::to_realtime_ns(fields.timestamp);
+    time_t t = ns / 1000000000;
+    std::tm tm;
+    localtime_r(&t, &tm);
+    size_t ts_len = std::strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+    ts_len += snprintf(ts + ts_len, sizeof(ts) - ts_len, ".%06d",
+                                            (int)(ns % 1000000000 / 1000));
+    ts_len += std::strftime(ts + ts_len, sizeof(ts) - ts_len, "%z", &tm);
+
+    json.raw('{');
+    json.key("ts", true);
+    json.string(std::string_view(ts, ts_len));
+    json.key("level");
+    json.raw('"');
+    append_log_level(line, fields);
+    json.raw('"');
+    json.key("logger");
+    json.string(_name);
+    json.key("thread");
+    json.string(thread_name());
+    json.key("line");
+    json.value(fields.line_number);
 }
 
 std::string logger::get_line_number() {
-    return std::to_string(_log_line_number);
+    std::string field;
+    log_append(field, _log_line_number.load(std::memory_order_relaxed));
+    return field;
 }
 
 std::string logger::get_thread_name() {
-    return _thread_name[ std::this_thread::get_id() ];
+    return thread_name();
+}
+
+std::string logger::get_log_level(log_level level) {
+    std::string field;
+    log_grace::reader guard(_grace);
+    append_log_level(field, { *_config.load(std::memory_order_acquire), level, 0, 0 });
+    return field;
+}
+
+std::string logger::get_date() {
+    std::string field;
+    log_grace::reader guard(_grace);
+    append_date(field, { *_config.load(std::memory_order_acquire),
+                         log_level::debug, 0, log_clock::now() });
+    return field;
+}
+
+std::string logger::get_time() {
+    std::string field;
+    log_grace::reader guard(_grace);
+    append_time(field, { *_config.load(std::memory_order_acquire),
+                         log_level::debug, 0, log_clock::now() });
+    return field;
+}
+
+std::string logger::get_logger_name() {
+    return _name;
+}
+
+std::string logger::get_empty_string() {
+    return std::string();
+}
+
+void logger::append_line_number(std::string& line, const header_fields& fields) {
+    log_append(line, fields.line_number);
 }
 
-std::string logger::get_log_level() {
-    switch(_current_level)
+void logger::append_thread_name(std::string& line, const header_fields& fields) {
+    (void) fields;
+    line.append(thread_name());
+}
+
+void logger::append_log_level(std::string& line, const header_fields& fields) {
+    switch(fields.level)
     {
     case log_level::debug:
-        return "DEBUG";
+        line.append("DEBUG");
+        break;
     case log_level::info:
-        return "INFO";
+        line.append("INFO");
+        break;
     case log_level::notice:
-        return "NOTICE";
+        line.append("NOTICE");
+        break;
     case log_level::warning:
-        return "WARNING";
+        line.append("WARNING");
+        break;
     case log_level::error:
-        return "ERROR";
+        line.append("ERROR");
+        break;
     case log_level::critical:
-        return "CRITICAL";
+        line.append("CRITICAL");
+        break;
     };
-    return std::string();
 }
 
-std::string logger::get_date() {
-    time_t t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-    std::ostringstream oss;
+static void append_cached_time(std::string& line, time_t second,
+                    const std::string& format, time_text_cache& cache) {
+    if (second != cache.second || format != cache.format) {
+        char buf[128];
+        std::tm tm;
+        localtime_r(&second, &tm);
+        cache.text.assign(buf, std::strftime(buf, sizeof(buf), format.c_str(), &tm));
+        cache.second = second;
+        cache.format = format;
+    }
+    line.append(cache.text);
+}
 
-    oss << std::put_time(&tm, _date_format.c_str());
-    return oss.str();
+/* localtime and strftime are only called once per second by each
+ * thread, the text is kept in a thread_local cache
+ */
+void logger::append_date(std::string& line, const header_fields& fields) {
+    thread_state* state = local_thread_state();
+    time_text_cache exiting;
+    time_t second = log_clock::to_realtime_ns(fields.timestamp) / 1000000000;
+
+    append_cached_time(line, second, fields.conf.date_format,
+                       state ? state->date : exiting);
 }
 
-std::string logger::get_time() {
-    time_t t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-    std::ostringstream oss;
+void logger::append_time(std::string& line, const header_fields& fields) {
+    thread_state* state = local_thread_state();
+    time_text_cache exiting;
+    time_t second = log_clock::to_realtime_ns(fields.timestamp) / 1000000000;
 
-    oss << std::put_time(&tm, _time_format.c_str());
-    return oss.str();
+    append_cached_time(line, second, fields.conf.time_format,
+                       state ? state->time : exiting);
 }
 
-std::string logger::get_logger_name() {
-    return _name;
+/* Fraction of the second, zero padded to digits */
+static void append_fraction(std::string& line, int64_t ns, int digits) {
+    char buf[9];
+    uint32_t value = ns % 1000000000;
+
+    for (int i = 9; i > digits; i--)
+        value /= 10;
+    for (int i = digits - 1; i >= 0; i--, value /= 10)
+        buf[i] = '0' + value % 10;
+    line.append(buf, digits);
 }
 
-std::string logger::get_empty_string() {
-    return std::string();
+void logger::append_millisecond(std::string& line, const header_fields& fields) {
+    append_fraction(line, log_clock::to_realtime_ns(fields.timestamp), 3);
+}
+
+void logger::append_microsecond(std::string& line, const header_fields& fields) {
+    append_fraction(line, log_clock::to_realtime_ns(fields.timestamp), 6);
+}
+
+void logger::append_nanosecond(std::string& line, const header_fields& fields) {
+    append_fraction(line, log_clock::to_realtime_ns(fields.timestamp), 9);
+}
+
+void logger::append_logger_name(std::string& line, const header_fields& fields) {
+    (void) fields;
+    line.append(_name);
+}
+
+void logger::append_empty_string(std::string& line, const header_fields& fields) {
+    (void) line;
+    (void) fields;
+}
+
+void logger::update_config(const std::function<void(config&)>& change)
+{
+    std::scoped_lock<std::mutex> lock(_config_mutex);
+
+    auto next = std::make_unique<config>(*_config.load(std::memory_order_relaxed));
+    change(*next);
+    const config* previous = _config.exchange(next.release(),
+                                              std::memory_order_acq_rel);
+
+    // After the store: a site that see the new tag see the new levels
+    _site_tag.store(next_site_tag(), std::memory_order_release);
+
+    // Freed once no producer can still read it
+    _grace.synchronize();
+    delete previous;
+}
+
+log_level logger::category_level(const config& conf, std::string_view category)
+{
+    while (!category.empty()) {
+        auto it = conf.category_levels.find(category);
+        if (it != conf.category_levels.end())
+            return it->second;
+
+        size_t dot = category.find_last_of('.');
+        category = category.substr(0, dot == std::string_view::npos ? 0 : dot);
+    }
+    return conf.min_log_level;
+}
+
+uint64_t logger::next_site_tag()
+{
+    return (_level_generation.fetch_add(1, std::memory_order_relaxed) << 24) |
+           ((_id & 0xffff) << 8);
+}
+
+uint64_t logger::resolve_site_level(log_site* site)
+{
+    // tag is loaded before the config, so the cache is never newer
+    // than the config it was resolved from
+    uint64_t tag = _site_tag.load(std::memory_order_acquire);
+    log_grace::reader guard(_grace);
+    const config& conf = *_config.load(std::memory_order_acquire);
+    uint64_t cache = tag | (uint64_t)category_level(conf, site->category());
+
+    site->set_level_cache(cache);
+    return cache;
+}
+
+void logger::set_category_level(const std::string& category, log_level level)
+{
+    update_config([&category, level](config& conf) {
+        conf.category_levels[category] = level;
+    });
+}
+
+void logger::clear_category_level(const std::string& category)
+{
+    update_config([&category](config& conf) {
+        conf.category_levels.erase(category);
+    });
+}
+
+log_level logger::get_category_level(const std::string& category)
+{
+    log_grace::reader guard(_grace);
+    return category_level(*_config.load(std::memory_order_acquire), category);
+}
+
+static std::string trim(const std::string& str)
+{
+    size_t first = str.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+        return std::string();
+    return str.substr(first, str.find_last_not_of(" \t\r") - first + 1);
+}
+
+static bool parse_log_level(const std::string& name, log_level& level)
+{
+    static const std::pair<const char*, log_level> names[] = {
+        { "debug", log_level::debug }, { "info", log_level::info },
+        { "notice", log_level::notice }, { "warning", log_level::warning },
+        { "error", log_level::error }, { "critical", log_level::critical } };
+
+    for (const auto& entry : names)
+        if (strcasecmp(name.c_str(), entry.first) == 0) {
+            level = entry.second;
+            return true;
+        }
+    return false;
+}
+
+bool logger::load_config(const std::string& filename)
+{
+    std::ifstream file(filename);
+    std::string text;
+    std::vector< std::function<void(config&)> > changes;
+
+    if (!file)
+        return false;
+
+    // Check every line before applying anything
+    while (std::getline(file, text)) {
+        text = trim(text);
+        if (text.empty() || text[0] == '#')
+            continue;
+
+        size_t equal = text.find('=');
+        if (equal == std::string::npos)
+            return false;
+        std::string key = trim(text.substr(0, equal));
+        std::string value = trim(text.substr(equal + 1));
+        // quotes keep the spaces of a pattern
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+            value = value.substr(1, value.size() - 2);
+
+        if (key == "level") {
+            log_level level;
+            if (!parse_log_level(value, level))
+                return false;
+            changes.push_back([level](config& conf) { conf.min_log_level = level; });
+        } else if (key.compare(0, 6, "level.") == 0 && key.size() > 6) {
+            log_level level;
+            if (!parse_log_level(value, level))
+                return false;
+            std::string category = key.substr(6);
+            changes.push_back([category, level](config& conf) {
+                conf.category_levels[category] = level;
+            });
+        } else if (key == "pattern") {
+            changes.push_back([value](config& conf) { parse_pattern(value, conf); });
+        } else if (key == "date_format") {
+            changes.push_back([value](config& conf) { conf.date_format = value; });
+        } else if (key == "time_format") {
+            changes.push_back([value](config& conf) { conf.time_format = value; });
+        } else if (key == "format" && (value == "text" || value == "json")) {
+            output_format format = value == "json" ? output_format::json :
+                                                     output_format::text;
+            changes.push_back([format](config& conf) { conf.format = format; });
+        } else
+            return false;
+    }
+
+    update_config([&changes](config& conf) {
+        for (const auto& change : changes)
+            change(conf);
+    });
+    return true;
+}
+
+bool logger::watch_config(const std::string& filename)
+{
+    size_t slash = filename.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." :
+                                    filename.substr(0, slash ? slash : 1);
+
+    if (!load_config(filename))
+        return false;
+
+    // The directory is watched, editors often replace the file
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    std::scoped_lock<std::mutex> lock(_watch_mutex);
+    if (_config_watch >= 0)
+        ::close(_config_watch);
+    _config_file = filename;
+    _config_watch = fd;
+    return true;
+}
+
+void logger::check_config_watch()
+{
+    alignas(struct inotify_event) char events[4096];
+    bool changed = false;
+    ssize_t len;
+
+    std::scoped_lock<std::mutex> lock(_watch_mutex);
+    if (_config_watch < 0)
+        return;
+
+    std::string name = _config_file.substr(_config_file.find_last_of('/') + 1);
+    while ((len = ::read(_config_watch, events, sizeof(events))) > 0) {
+        for (char* ptr = events; ptr < events + len; ) {
+            auto event = reinterpret_cast<struct inotify_event*>(ptr);
+            if (event->len && name == event->name)
+                changed = true;
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if (changed && !load_config(_config_file))
+        LOG_WARNING( "Config file ", _config_file, " is invalid, not applied" );
 }
 
 void logger::set_pattern(const std::string &pattern) {
+    update_config([&pattern](config& conf) { parse_pattern(pattern, conf); });
+}
+
+void logger::parse_pattern(const std::string &pattern, config& conf) {
     std::string userchar;
     headerElement format_elmt;
 
     // Clear previous pattern
-    _header_pattern.clear();
+    conf.header_pattern.clear();
 
     for (auto it = pattern.begin(); it < pattern.end(); ++it) {
         
@@ -252,41 +1379,50 @@ void logger::set_pattern(const std::string &pattern) {
             it++; // check the char after '%'
             switch (*it) {
             case 'd': //date
-                format_elmt.second = (&logger::get_date);
+                format_elmt.second = (&logger::append_date);
                 if(*(++it) == FORMAT_DELIMITER) {
-                    _date_format.clear();
+                    conf.date_format.clear();
                     for(++it;*it != FORMAT_DELIMITER; ++it)
-                        _date_format.push_back(*it);
+                        conf.date_format.push_back(*it);
                     it++;
                 }
                 it--;
                 break;
             case 'i': //index = line number
-                format_elmt.second = (&logger::get_line_number);
+                format_elmt.second = (&logger::append_line_number);
                 break;
             case 'l': //Log level
-                format_elmt.second = (&logger::get_log_level);
+                format_elmt.second = (&logger::append_log_level);
+                break;
+            case 'm': //milliseconds
+                format_elmt.second = (&logger::append_millisecond);
+                break;
+            case 'u': //microseconds
+                format_elmt.second = (&logger::append_microsecond);
+                break;
+            case 'N': //nanoseconds
+                format_elmt.second = (&logger::append_nanosecond);
                 break;
             case 'n': //logger name
-                format_elmt.second = (&logger::get_logger_name);
+                format_elmt.second = (&logger::append_logger_name);
                 break;
             case 't': //time
-                format_elmt.second = (&logger::get_time);
+                format_elmt.second = (&logger::append_time);
                 if(*(++it) == FORMAT_DELIMITER) {
-                    _time_format.clear();
+                    conf.time_format.clear();
                     for(++it;*it != FORMAT_DELIMITER; ++it)
-                        _time_format.push_back(*it);
+                        conf.time_format.push_back(*it);
                     it++;
                 }
                 it--;
                 break;
             case 'x': //thread name
-                format_elmt.second = (&logger::get_thread_name);
+                format_elmt.second = (&logger::append_thread_name);
                 break;
             default:
-                format_elmt.second = (&logger::get_empty_string);
+                format_elmt.second = (&logger::append_empty_string);
             }
-            _header_pattern.push_back(format_elmt);
+            conf.header_pattern.push_back(format_elmt);
         }
         
     }
@@ -294,17 +1430,20 @@ void logger::set_pattern(const std::string &pattern) {
     if(!userchar.empty()) {
         format_elmt.first = userchar;
         userchar.clear();
-        format_elmt.second = (&logger::get_empty_string); // Nothing after
-        _header_pattern.push_back(format_elmt);
+        format_elmt.second = (&logger::append_empty_string); // Nothing after
+        conf.header_pattern.push_back(format_elmt);
     }
 
 }
 
+void logger::set_output_format(output_format format){
+    update_config([format](config& conf) { conf.format = format; });
+}
+
 void logger::set_date_format(const std::string &fmt){
-    _date_format = fmt;
- 
+    update_config([&fmt](config& conf) { conf.date_format = fmt; });
 }
 
 void logger::set_time_format(const std::string &fmt){
-    _time_format = fmt;
+    update_config([&fmt](config& conf) { conf.time_format = fmt; });
 }
\ No newline at end of file
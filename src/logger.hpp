@@ -18,47 +18,70 @@
 #include <string>
 #include <sstream>
 #include <map>
-#include <queue>
+#include <deque>
 #include <vector>
 
 #include <mutex>
 #include <atomic>
 #include <thread>
 #include <condition_variable>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <memory>
 #include <utility>
 
 #include "log_policy.hpp"
+#include "log_site.hpp"
+#include "log_format.hpp"
+#include "log_clock.hpp"
+#include "log_grace.hpp"
+#include "log_span.hpp"
+#include "record_ring.hpp"
 
 /**
- * @brief log level definition
- * @brief macro defined to ease logger print call
- * @param debug debug message
- * @param info information (ex startup a service)
- * @param notice Nothing serious, but notably nevertheless
- * @param warning Nothing serious by itself but might indicate problems
- * @param error Error condition
- * @param critical Critical condition, should stop or abord
+ * @brief LOGGER_COROUTINES is defined when the compiler support C++20
+ * @brief coroutines, the awaitable API (flush_async, print_async) is
+ * @brief then available
  */
-enum class log_level
-{
-    debug = 1,
-    info,
-    notice,
-    warning,
-    error,
-    critical      //6
-};
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <tuple>
+#define LOGGER_COROUTINES
+#endif
 
 /**
  * @brief macros. Prefered way to print using the logger
  * @brief logger->LOG_DEBUG("Locked here since ", 100, "days");
+ * @brief each macro carry its own call site (see log_site.hpp),
+ * @brief which is used for rate limiting (see set_rate_limit)
+ */
+#define LOG_DEBUG       print_from<log_level::debug>(LOG_SITE_HERE)
+#define LOG_INFO        print_from<log_level::info>(LOG_SITE_HERE)
+#define LOG_NOTICE      print_from<log_level::notice>(LOG_SITE_HERE)
+#define LOG_WARNING     print_from<log_level::warning>(LOG_SITE_HERE)
+#define LOG_ERROR       print_from<log_level::error>(LOG_SITE_HERE)
+#define LOG_CRITICAL    print_from<log_level::critical>(LOG_SITE_HERE)
+
+/**
+ * @brief category macros, the level of the call site is the one
+ * @brief of its category (see set_category_level)
+ * @brief logger->LOG_CAT_DEBUG("net.http")("GET ", url);
  */
-#define LOG_DEBUG       print<log_level::debug>
-#define LOG_INFO        print<log_level::info>
-#define LOG_NOTICE      print<log_level::notice>
-#define LOG_WARNING     print<log_level::warning>
-#define LOG_ERROR       print<log_level::error>
-#define LOG_CRITICAL    print<log_level::critical>
+#define LOG_CAT_DEBUG(category)     print_from<log_level::debug>(LOG_SITE_CATEGORY(category))
+#define LOG_CAT_INFO(category)      print_from<log_level::info>(LOG_SITE_CATEGORY(category))
+#define LOG_CAT_NOTICE(category)    print_from<log_level::notice>(LOG_SITE_CATEGORY(category))
+#define LOG_CAT_WARNING(category)   print_from<log_level::warning>(LOG_SITE_CATEGORY(category))
+#define LOG_CAT_ERROR(category)     print_from<log_level::error>(LOG_SITE_CATEGORY(category))
+#define LOG_CAT_CRITICAL(category)  print_from<log_level::critical>(LOG_SITE_CATEGORY(category))
+
+/**
+ * @brief scope timer macro, time the scope of the returned object
+ * @brief auto timer = logger->LOG_SCOPE_TIMER("db.query");
+ * @brief the durations of each call site are reported periodically,
+ * @brief see set_span_report
+ */
+#define LOG_SCOPE_TIMER(name)       scope_timer(LOG_SPAN_SITE(name))
 
 /**
  * @brief DEFAULT_PATTERN is the default header pattern when instancing
@@ -78,12 +101,55 @@ enum class log_level
  */
 #define LOGGER_DELAY 10
 
+/**
+ * @brief LOGGER_LINE_KEEP is the max capacity kept by the string a
+ * @brief thread build its lines in, see line_buffer
+ */
+#define LOGGER_LINE_KEEP 65536
+
+/**
+ * @brief LOGGER_CRASH_SLOTS is the max count of loggers that will be
+ * @brief dumped by the crash handler (see install_crash_handler)
+ * @brief LOGGER_CRASH_FRAMES is the max depth of the backtrace
+ */
+#define LOGGER_CRASH_SLOTS 64
+#define LOGGER_CRASH_FRAMES 64
+
+/**
+ * @brief LOGGER_SHUTDOWN_TIMEOUT is the default time in ms given to the
+ * @brief daemons to drain their queues, see shutdown_all
+ */
+#define LOGGER_SHUTDOWN_TIMEOUT 1000
+
 /**
  * @brief DEFAULT_LOGGER_NAME is the default name is arg is
  * not specified in the constructor
  */
 #define DEFAULT_LOGGER_NAME "./logger.log"
 
+template< log_level severity >
+class log_site_printer;
+
+class log_scope_timer;
+
+class log_flush_awaiter;
+
+template< typename...Args >
+class log_print_awaiter;
+
+/**
+ * @brief log_executor is implemented by the application to resume
+ * @brief the coroutines waiting on a logger (flush_async, print_async)
+ * @brief on its own threads, i.e. by posting to its event loop.
+ * @brief Without executor, they are resumed by the logger thread
+ */
+class log_executor
+{
+public:
+    virtual ~log_executor() = default;
+    virtual void post(std::function<void()> task) = 0;
+};
+
 /**
  * @brief logger shall be instantiated with a specific log_policy
  * @brief by default a standard file log policy is set in the
@@ -114,8 +180,9 @@ public:
     ~logger();
 
     /** @brief print the function to be called to log data.
-     *  @brief variadics args combine all supported
-     *  @brief std::stringstream << operator support
+     *  @brief variadics args are appended one after each other
+     *  @brief by their log_formatter (see log_format.hpp), i.e.
+     *  @brief any type supporting operator<< or a log_formatter
      *  @brief header with user pattern is prepared here
      */ 
     template< typename...Args >
@@ -128,6 +195,122 @@ public:
     template< log_level severity , typename...Args >
     void print(Args&&...args);
 
+    /** @brief print_durable() print, and get a future which is ready
+     *  @brief once the line is durable, i.e. written and synced by the
+     *  @brief policy (fdatasync for file policies in durability::group_commit
+     *  @brief mode). All the waiters of a batch share one sync.
+     *  @brief Intended for critical lines, i.e.
+     *  @brief logger->print_durable(log_level::critical, "...").wait();
+     */ 
+    template< typename...Args >
+    std::future<void> print_durable(log_level severity, Args&&...args);
+
+    /** @brief flush_async() awaitable (C++20), resumed once the lines
+     *  @brief logged before by this thread are written and flushed by
+     *  @brief the policy. Never block the calling thread
+     *  @brief co_await logger->flush_async();
+     */
+    log_flush_awaiter flush_async();
+
+    /** @brief print_async() awaitable print (C++20). If the queue hold
+     *  @brief set_async_queue_limit lines or more, the coroutine is
+     *  @brief suspended until the daemon take the queue, instead of
+     *  @brief blocking the thread. The line is formatted when resumed
+     *  @brief co_await logger->print_async(log_level::info, "...");
+     */
+    template< typename...Args >
+    log_print_awaiter<Args...> print_async(log_level severity, Args&&...args);
+
+    /** @brief set_executor() the coroutines waiting on this logger are
+     *  @brief resumed by executor->post(), nullptr to resume them on
+     *  @brief the logger thread. The executor shall outlive the logger
+     */
+    void set_executor(log_executor* executor);
+
+    /** @brief set_async_queue_limit() max lines in the queue before
+     *  @brief print_async suspend, 0 (default) for no limit. print
+     *  @brief never wait, so its lines may exceed the limit
+     */
+    void set_async_queue_limit(size_t max_lines);
+
+    /** @brief print_from() bind a call site to the logger
+     *  @brief Ex. logger->print_from<log_level::debug>(LOG_SITE_HERE)(...)
+     *  @brief just here to have the macro LOG_INFO, ...
+     *  @return a callable object which forward args to print_site
+     */
+    template< log_level severity >
+    log_site_printer<severity> print_from(log_site* site);
+
+    /** @brief print_site() print, subject to the level of the site
+     *  @brief category and to the rate limit of the site.
+     *  @brief the check is done before any formatting. If the site
+     *  @brief has dropped messages, a "last message repeated" line
+     *  @brief is logged before the message.
+     */
+    template< typename...Args >
+    void print_site(log_level severity, log_site* site, Args&&...args);
+
+    /** @brief scope_timer() time a scope, until the returned object
+     *  @brief is destroyed. Only two clock reads and a span pushed in
+     *  @brief the queue, nothing if the reports are disabled
+     *  @brief just here to have the macro LOG_SCOPE_TIMER
+     */
+    log_scope_timer scope_timer(log_span_site* site);
+
+    /** @brief set_span_report()
+     *  @brief enable the scope timers (LOG_SCOPE_TIMER). The daemon
+     *  @brief aggregate the spans per call site, and every interval log
+     *  @brief one line per site timed meanwhile:
+     *  @brief "span db.query count 12, p50 .., p99 .., max .., mean .. (file:line)"
+     *  @brief A last report is logged when the logger is stopped
+     *  @param interval 0 disable the timers
+     *  @param target logger the reports are printed to, i.e. with its
+     *  @brief own policy, nullptr for this one. It shall outlive this one
+     *  @param level of the report lines
+     */
+    void set_span_report(std::chrono::milliseconds interval,
+                         logger* target = nullptr,
+                         log_level level = log_level::info);
+
+    /** @brief set_rate_limit()
+     *  @brief limit the messages logged by each call site (LOG_* macros)
+     *  @brief using a token bucket. Messages over the limit are dropped
+     *  @brief and counted before any formatting or enqueue work.
+     *  @param max_per_second token regeneration rate, 0 disable limiting
+     *  @param burst bucket size, i.e. messages that can be logged at once
+     */
+    void set_rate_limit(unsigned int max_per_second, unsigned int burst = 1);
+
+    /** @brief set_cpu_affinity()
+     *  @brief pin the daemon(s) of this logger to a cpu set, kept by
+     *  @brief set_numa_node and set_numa_backends (a daemon bound to a
+     *  @brief node is pinned to the cpus of the set on its node, if any)
+     *  @param cpus cpu numbers, as in /proc/cpuinfo
+     *  @return false if the set is empty or invalid
+     */
+    bool set_cpu_affinity(const std::vector<int>& cpus);
+
+    /** @brief set_numa_node()
+     *  @brief move the queue and the daemon to a NUMA node: the ring is
+     *  @brief allocated on it (numa_alloc_onnode if built with NUMA=1,
+     *  @brief first touch otherwise) and the daemon run on its cpus.
+     *  @brief Placement is meant to be set before logging starts: it is
+     *  @brief safe while other threads log, but their lines wait until
+     *  @brief the previous queue is drained (see restart_backends)
+     *  @return false if the node doesn't exist
+     */
+    bool set_numa_node(int node);
+
+    /** @brief set_numa_backends()
+     *  @brief one queue and daemon per NUMA node, each producer thread
+     *  @brief logs to the queue of its node. Lines of a thread stay in
+     *  @brief order, lines of threads on different nodes may be
+     *  @brief reordered in the output. Like set_numa_node, meant to be
+     *  @brief called before logging starts
+     *  @return the count of backends
+     */
+    int set_numa_backends();
+
     /** @brief set_thread_name()
      *  @brief set the thread name of the calling thread
      *  @brief that will be logged on each line (store in a map)
@@ -141,6 +324,25 @@ public:
      */ 
     void set_min_log_level(log_level new_level);
 
+    /** @brief set_category_level()
+     *  @brief set the level of a category and of its sub categories,
+     *  @brief i.e. "net" apply to "net.http" unless "net.http" has
+     *  @brief its own level. Sites without category, or with a category
+     *  @brief not set, use the min log level
+     *  @param category dot separated name, i.e. "net.http"
+     */
+    void set_category_level(const std::string& category, log_level level);
+
+    /** @brief clear_category_level()
+     *  @brief the category use again the level of its parent
+     */
+    void clear_category_level(const std::string& category);
+
+    /** @brief get_category_level()
+     *  @return the level applied to a category
+     */
+    log_level get_category_level(const std::string& category);
+
     /** @brief set_default_logger()
      *  @brief set the current logger
      *  as the default logger, which will be
@@ -170,10 +372,42 @@ public:
 
     /** @brief logger_killall()
      *  @brief destroy all the logger created and still
-     *  @brief alive.
+     *  @brief alive (shutdown_all without timeout).
      */ 
     static void logger_killall();
 
+    /** @brief shutdown_all() stop and destroy all the loggers at once:
+     *  @brief their daemons drain the queues in parallel, every line
+     *  @brief queued before the call is written. Once timeout is
+     *  @brief elapsed, the lines left are dropped, and a daemon still
+     *  @brief blocked in its policy is detached: its logger is removed
+     *  @brief from the list but not destroyed.
+     *  @param timeout 0 for no limit
+     *  @return false if lines were dropped
+     */
+    static bool shutdown_all(std::chrono::milliseconds timeout =
+                    std::chrono::milliseconds(LOGGER_SHUTDOWN_TIMEOUT));
+
+    /** @brief install_exit_handler() call shutdown_all(timeout) on
+     *  @brief exit() (after the return of main) and quick_exit(), so
+     *  @brief that no line is lost even if the loggers are not deleted.
+     *  @brief It may be called again to change the timeout
+     */
+    static void install_exit_handler(std::chrono::milliseconds timeout =
+                    std::chrono::milliseconds(LOGGER_SHUTDOWN_TIMEOUT));
+
+    /** @brief install_crash_handler()
+     *  @brief on SIGSEGV, SIGABRT and SIGBUS, write the lines still
+     *  @brief pending in the queue of every live logger, then a backtrace,
+     *  @brief and let the signal kill the process. Only async-signal-safe
+     *  @brief calls and preallocated buffers are used in the handler,
+     *  @brief which run on an alternate stack (for the calling thread).
+     *  @param filename file where the dump is written (opened now, in
+     *  @brief append mode), stderr if empty
+     *  @return false if the file can't be opened or handler not installed
+     */ 
+    static bool install_crash_handler(const std::string& filename = "");
+
     /** @brief set_pattern()
      *  @brief Set the header pattern to be logged
      *  @param pattern is a string describing the format. String is composed by:
@@ -187,6 +421,9 @@ public:
      *          `%i` : (index) = line number. Be aware that line number
      *                  is incremented even if you don't show it in your log.
      *          `%l` : log level of the message (i.e. `CRITICAL`)
+     *          `%m` : milliseconds of the time, 3 digits
+     *          `%u` : microseconds of the time, 6 digits
+     *          `%N` : nanoseconds of the time, 9 digits
      *          `%n` : logger name, set up in the constructor 
      *                  (useless for file logging as it is the name of the file)
      *          `%t` : time field, see below to format it
@@ -196,6 +433,14 @@ public:
      */ 
     void set_pattern(const std::string &pattern);
 
+    /** @brief set_output_format()
+     *  @brief output_format::text (default) build each line with the
+     *  @brief header pattern. output_format::json write one JSON object
+     *  @brief per line, with the fields ts, level, logger, thread, line,
+     *  @brief msg (non kv args concatenated) and one field per kv() arg
+     */ 
+    void set_output_format(output_format format);
+
     /** @brief set_date_format()
      *   @param fmt the required format, according to std::put_time() format
      */ 
@@ -213,10 +458,93 @@ public:
     std::string get_date();
     std::string get_time();
     std::string get_thread_name();
-    std::string get_log_level();
+    std::string get_log_level(log_level level);
     std::string get_logger_name();
     std::string get_empty_string();
 
+    struct header_fields;
+    typedef std::pair<std::string,
+                void (logger::*)(std::string&, const header_fields&)> headerElement;
+
+    /** @brief config is everything print read from the user settings.
+     *  @brief A published snapshot is never modified: the setters copy
+     *  @brief the current one, change the copy and publish it, so that
+     *  @brief a producer see a consistent config with one atomic load
+     *  @brief (in a _grace reader section, see update_config)
+     */
+    struct config
+    {
+        /** @brief header_pattern store the user pattern
+         *  @brief it is a vector of pair 
+         *  @brief pair first are user char (separator, decorator,...)
+         *  @brief pair second are pointer to member function that will append the info
+         *  @brief first could be empty string and second could be a function
+         *  @brief that will append nothing (logger::append_empty_string)
+         */
+        std::vector<headerElement> header_pattern;
+
+        /* min log level, message with a inferior level will not be printed */
+        log_level min_log_level;
+
+        /** @brief category_levels levels set by set_category_level
+         */
+        std::map< std::string, log_level, std::less<> > category_levels;
+
+        /** @brief format text or JSON lines, see set_output_format
+         */
+        output_format format;
+
+        /** @brief date_format and time_format
+         *  @brief are captured in set_pattern when FORMAT_DELIMITER
+         *  @brief char directly follow date or time tag. If FORMAT_DELIMITER is '&'
+         *  @brief %d&date_format& where date_format is directly compliant with 
+         *  @brief std::put_time format
+         */
+        std::string date_format;
+        std::string time_format;
+    };
+
+    /** @brief header_fields what the header functions need about
+     *  @brief the line, given as parameter so that print need no lock
+     */
+    struct header_fields
+    {
+        const config& conf;
+        log_level level;
+        uint64_t line_number;
+        uint64_t timestamp;     // log_clock ticks
+    };
+
+    /** @brief Header functions, append the field to the line
+     *  @brief without temporary string. Used by the header pattern
+     */
+    void append_line_number(std::string& line, const header_fields& fields);
+    void append_date(std::string& line, const header_fields& fields);
+    void append_time(std::string& line, const header_fields& fields);
+    void append_millisecond(std::string& line, const header_fields& fields);
+    void append_microsecond(std::string& line, const header_fields& fields);
+    void append_nanosecond(std::string& line, const header_fields& fields);
+    void append_thread_name(std::string& line, const header_fields& fields);
+    void append_log_level(std::string& line, const header_fields& fields);
+    void append_logger_name(std::string& line, const header_fields& fields);
+    void append_empty_string(std::string& line, const header_fields& fields);
+
+    /** @brief load_config() apply a config file at once, in one snapshot.
+     *  @brief One "key = value" per line, '#' start a comment. Keys:
+     *  @brief level (debug ... critical), level.<category>, pattern,
+     *  @brief date_format, time_format, format (text or json)
+     *  @return false if the file can't be read or has an invalid line,
+     *  @brief nothing is applied in this case
+     */
+    bool load_config(const std::string& filename);
+
+    /** @brief watch_config() load the file, then reload it each time
+     *  @brief it is written or replaced (inotify on its directory).
+     *  @brief The check is done by the daemon, between two batches
+     *  @return false if the file can't be loaded or watched
+     */
+    bool watch_config(const std::string& filename);
+
 private:
     /** @brief terminate_logger()
      *  @brief kill the thread
@@ -224,29 +552,322 @@ private:
      */ 
     void terminate_logger();
 
+    /** @brief unregister() remove the logger from the list, and
+     *  @brief elect another default logger if it was the default one
+     */
+    void unregister();
+
+    /** @brief exit_handler() registred by install_exit_handler
+     */
+    static void exit_handler();
+
+    /** @brief request_stop() wake up the daemons to drain the queues
+     *  @brief and exit, without waiting for them
+     *  @param deadline_ns steady clock time the lines left are dropped
+     *  @brief at, 0 for none
+     */
+    void request_stop(int64_t deadline_ns);
+
+    /** @brief stop_expired() true once the deadline of request_stop
+     *  @brief is elapsed
+     */
+    bool stop_expired() const;
+
+    /** @brief backend is a queue and the daemon that perform the
+     *  @brief output operations of this queue
+     */
+    struct backend
+    {
+        backend(int numa_node, bool first_backend):
+            node(numa_node), first(first_backend), running(true),
+            ring(RECORD_RING_SIZE, numa_node), queued(0) { }
+
+        /** @brief node the daemon and its allocations are bound to,
+         *  @brief -1 if not bound
+         */
+        int node;
+
+        /** @brief first is the first backend of its set, its daemon
+         *  @brief also check the config file, the clock and the spans
+         */
+        bool first;
+
+        /** @brief running cleared to stop the daemon of this backend
+         */
+        std::atomic<bool> running;
+
+        /** @brief the write mutex of the queue
+         */
+        std::mutex write_mutex;
+
+        /** @brief data_available is notify by the print method of the logger
+         * it will wake up the logging thread that will process log datas.
+         */
+        std::condition_variable data_available;
+
+        /** @brief ring is the media between the current user
+         *  @brief input operations and the daemon thread that perform
+         *  @brief output operations, see record_ring
+         */
+        record_ring ring;
+
+        /** @brief log_buffer is the overflow of the ring: the lines that
+         *  @brief don't fit in it, and the lines pushed after them until
+         *  @brief the daemon take them, so that the order is kept
+         */
+        std::deque< log_record > log_buffer;
+
+        /** @brief writing is the batch of records taken by the daemon
+         *  @brief from log_buffer, not written yet. Only used by the daemon
+         *  @brief (and the crash handler)
+         */
+        std::deque< log_record > writing;
+
+        /** @brief queued count of lines pushed (ring and log_buffer)
+         *  @brief since the daemon took the queue
+         */
+        size_t queued;
+
+        /** @brief sync_waiters are the promises of print_durable, set
+         *  @brief by the daemon once the policy is synced. Protected by
+         *  @brief write_mutex
+         */
+        std::vector< std::promise<void> > sync_waiters;
+
+        /** @brief flush_waiters are resumed (see resume) once the batch
+         *  @brief they are taken with is flushed. space_waiters once the
+         *  @brief queue is taken. Both protected by write_mutex
+         */
+        std::vector< std::function<void()> > flush_waiters;
+        std::deque< std::function<void()> > space_waiters;
+
+        std::thread daemon;
+    };
+
+    friend class log_flush_awaiter;
+    template< typename...Args >
+    friend class log_print_awaiter;
+    friend class log_scope_timer;
+
+    /** @brief push_span() queue the span of a scope timer, without
+     *  @brief waking up the daemon: it take the queue within LOGGER_DELAY
+     */
+    void push_span(const log_span_site* site, uint64_t start, uint64_t end);
+
+    /** @brief add_span() aggregate a span in _spans. Called by the
+     *  @brief daemons with _policy_mutex held
+     */
+    void add_span(const log_record_view& record);
+
+    /** @brief report_spans() log the histograms of the sites timed
+     *  @brief since the last report, and reset them. Called by the
+     *  @brief first daemon once the interval is elapsed, and once
+     *  @brief stopped, in its first pass
+     *  @param force report even if the interval is not elapsed
+     *  @return true if lines were printed to this logger
+     */
+    bool report_spans(bool force);
+
+    /** @brief backend_set the backends of a logger, published at once
+     */
+    typedef std::vector< std::unique_ptr<backend> > backend_set;
+
+    /** @brief when_flushed() register task to be resumed once the
+     *  @brief lines queued before by this thread are flushed, resumed
+     *  @brief at once if the daemon is stopped (its lines are written)
+     */
+    void when_flushed(std::function<void()> task);
+
+    /** @brief queue_flush_waiter() queue task to the daemon of this
+     *  @brief thread, in a _grace reader section
+     *  @return false if the daemon is stopped, task is left then
+     */
+    bool queue_flush_waiter(std::function<void()>& task);
+
+    /** @brief when_queue_space() register task to be resumed once the
+     *  @brief queue of this thread is below the async queue limit
+     *  @return false if it is already, or if the daemon is stopped,
+     *  @brief task is not registered then
+     */
+    bool when_queue_space(std::function<void()> task);
+
+    /** @brief resume() post task to the executor, or run it
+     */
+    void resume(std::function<void()>& task);
+
+    /** @brief resume_waiters() resume the waiters left after the
+     *  @brief daemons of a set are stopped, the current one by default
+     */
+    void resume_waiters(backend_set* backends = nullptr);
+
     /** @brief logging_thread()
-     *  @brief this thread push the logging queue
+     *  @brief this thread push the logging queue of a backend
      *  to the write policy (ies)
+     *  @param cpus the thread is pinned to, see daemon_cpus
      */ 
-    void logging_thread();
+    void logging_thread(backend* back, std::vector<int> cpus);
+
+    /** @brief make_backends() one backend per node, daemons not started
+     *  @param nodes NUMA node of each backend, -1 for no binding
+     */
+    static backend_set* make_backends(const std::vector<int>& nodes);
+
+    /** @brief start_backends() spawn the daemons of a set, with
+     *  @brief _placement_mutex held (or from the constructor)
+     */
+    void start_backends(backend_set& backends);
+
+    /** @brief stop_backends() drain the queues of a set and join its
+     *  @brief daemons, the current one by default
+     */
+    void stop_backends(backend_set* backends = nullptr);
+
+    /** @brief restart_backends() publish a new set on the given nodes.
+     *  @brief Once no producer use the previous set (_grace), it is
+     *  @brief drained, then the daemons of the new one are started, so
+     *  @brief that no line is lost and the lines of a thread stay in order
+     */
+    void restart_backends(const std::vector<int>& nodes);
+
+    /** @brief daemon_cpus() cpus a daemon of node shall run on: the
+     *  @brief cpus of affinity on the node, or all those of the node if
+     *  @brief none. Empty if not pinned
+     */
+    static std::vector<int> daemon_cpus(int node, const std::vector<int>& affinity);
+
+    /** @brief update_config() copy the current config, apply change
+     *  @brief to the copy and publish it, then free the previous one
+     *  @brief once no producer read it (so not to be called while a
+     *  @brief line is formatted, i.e. by a log_formatter)
+     */
+    void update_config(const std::function<void(config&)>& change);
+
+    /** @brief parse_pattern() fill the header pattern of conf, and its
+     *  @brief date and time format if given in the pattern
+     */
+    static void parse_pattern(const std::string& pattern, config& conf);
+
+    /** @brief check_config_watch() reload the config if the watched
+     *  @brief file has changed. Called by the first daemon
+     */
+    void check_config_watch();
+
+    /** @brief local_backend() backend of the calling thread, given by
+     *  @brief its home node, i.e. the node it was running on when it
+     *  @brief first logged. A thread always use the same queue so the
+     *  @brief order of its lines is kept. Shall be called in a _grace
+     *  @brief reader section, which last as long as the backend is used
+     */
+    backend& local_backend();
 
     /** @brief print_impl core printing method
-     *  @brief will be called once the overloaded recursive
-     *  @brief will reach the end. It push the stream to the 
+     *  @brief will be called once all the args are appended
+     *  @brief to the line. It push the line to the 
      *  @brief log buffer which will be exploited by the deamon 
      */
-    void print_impl(std::stringstream&&);
+    void print_impl(const header_fields& fields, std::string& line,
+                    const char* literal = nullptr, size_t literal_offset = 0);
 
-    /** @brief print_impl overloaded variadic
-     *  @brief it will be called by public print method
+    /** @brief push_line() copy a formatted line in the queue of the
+     *  @brief calling thread and wake up the daemon
      */
-    template<typename First, typename...Rest>
-    void print_impl(std::stringstream&&,First&& parm1,Rest&&...parm);
+    void push_line(const header_fields& fields, std::string_view line,
+                   const char* literal = nullptr, size_t literal_offset = 0);
 
-    /** @brief _print_mutex to protect print access
-     * if multi threaded app call the logger.
+    /** @brief write_queued() give a record of the ring to the policy,
+     *  @brief in place if it accept views. Otherwise, or if the literal
+     *  @brief shall be inserted, the record is copied in _scratch.
+     *  @brief Called with _policy_mutex held
      */
-    std::mutex _print_mutex;
+    void write_queued(const log_record_view& record, bool literals, bool views);
+
+    /** @brief line_buffer the string a line is built in: a thread_local
+     *  @brief string reused from line to line, so that formatting doesn't
+     *  @brief allocate. A line printed while another is built (i.e. by
+     *  @brief a log_formatter), or once the thread_locals of the thread
+     *  @brief are destroyed (exit handler), use its own string
+     */
+    class line_buffer
+    {
+    public:
+        line_buffer();
+        ~line_buffer();
+        line_buffer(const line_buffer&) = delete;
+        line_buffer& operator=(const line_buffer&) = delete;
+
+        std::string& str() { return *_line; }
+
+    private:
+        std::string* _line;
+        std::string _own;
+        bool _reused;
+    };
+
+    /** @brief append_literal_message() append the message but its
+     *  @brief first arg, a const char array, if it has static storage
+     *  @return the first arg in this case, nullptr otherwise
+     */
+    template< size_t N, typename...Args >
+    static const char* append_literal_message(std::string& line,
+                            const char (&first)[N], const Args&...args);
+
+    /** @brief print_line() build the line from a config snapshot
+     *  @brief and queue it, the level is already checked
+     */
+    template< typename...Args >
+    void print_line(log_level severity, const config& conf, Args&&...args);
+
+    /** @brief site_enabled() check the level of a site against its
+     *  @brief cached category level, resolved again if the cache is
+     *  @brief not tagged with _site_tag (another logger or an older
+     *  @brief generation). Two relaxed loads and a compare otherwise
+     */
+    bool site_enabled(log_level severity, log_site* site);
+
+    /** @brief resolve_site_level() find the level of the site category
+     *  @brief and store it in the site cache, with the current tag
+     *  @return the new cache value
+     */
+    uint64_t resolve_site_level(log_site* site);
+
+    /** @brief next_site_tag() a new _site_tag, of a new generation
+     */
+    uint64_t next_site_tag();
+
+    /** @brief category_level() level of the closest category set
+     *  @brief in conf, i.e. "net.http", then "net", then min_log_level
+     */
+    static log_level category_level(const config& conf, std::string_view category);
+
+    /** @brief thread_name() name of the calling thread for this logger.
+     *  @brief Names are thread_local (only a thread set and read its own
+     *  @brief name), keyed by logger _id, so no lock is needed
+     */
+    const std::string& thread_name();
+
+    /** @brief json_header() append the fixed fields of a JSON line,
+     *  @brief the object is left open for msg and kv fields
+     */
+    void json_header(std::string& line, const header_fields& fields);
+
+    /** @brief print_json() JSON counterpart of print_impl, the line
+     *  @brief is built in line, the buffer of print_line
+     */
+    template< typename...Args >
+    void print_json(const header_fields& fields, std::string& line,
+                    Args&&...args);
+
+    /** @brief crash_handler() the signal handler
+     *  @brief of install_crash_handler
+     */
+    static void crash_handler(int sig);
+
+    /** @brief _crash_slots are the live loggers, seen by the crash handler
+     *  @brief a fixed array as the heap may be corrupted when it is read
+     *  @brief _crash_fd is the file descriptor of the dump
+     */
+    static std::atomic<logger*> _crash_slots[LOGGER_CRASH_SLOTS];
+    static int _crash_fd;
 
     /** @brief The first logger to be registred or
      * the one set by set_default_logger();
@@ -255,52 +876,59 @@ private:
      */
     static logger* _default_logger;
 
-    typedef std::pair<std::string, std::string (logger::*)()> headerElement;
-    /** @brief _header_pattern store the user pattern
-     *  @brief it is a vector of pair 
-     *  @brief pair first are user char (separator, decorator,...)
-     *  @brief pair second are pointer to member function that will return the info
-     *  @brief first could be empty string and second could be a function
-     *  @brief that will return empty string (logger::get_empty_string)
+    /** @brief _config the current config snapshot, owned by the
+     *  @brief logger. Producers read it in a _grace reader section, the
+     *  @brief previous one is freed by update_config after the grace
+     *  @brief period. _config_mutex serialize the setters
      */
-    std::vector<headerElement> _header_pattern;
+    std::atomic<const config*> _config;
 
-    /* min log level, message with a inferior level will not be printed */
-    log_level _min_log_level;
-    log_level _current_level; // only way to pass the level to the function
-  
-    /** @brief _date_format and _time_format
-     *  @brief are captured in set_pattern when FORMAT_DELIMITER
-     *  @brief char directly follow date or time tag. If FORMAT_DELIMITER is '&'
-     *  @brief %d&date_format& where date_format is directly compliant with 
-     *  @brief std::put_time format
+    /** @brief _site_tag tag of a valid level cache of a site for this
+     *  @brief logger: generation, logger id, then 8 bits for the level.
+     *  @brief A new generation is taken from _level_generation (unique
+     *  @brief in the process, as ids may be reused) each time this
+     *  @brief logger publish a config, which invalidate only its sites
+     *  @brief _id identify the logger in the cache of the sites (low
+     *  @brief 16 bits) and in the thread names of the threads
      */
-    std::string _date_format;
-    std::string _time_format;
+    std::atomic<uint64_t> _site_tag;
+    static std::atomic<uint64_t> _level_generation;
+    static std::atomic<uint64_t> _next_id;
+    uint64_t _id;
+    std::mutex _config_mutex;
 
-    /** @brief _daemon is the daemon that perform the output operations
+    /** @brief _config_watch inotify descriptor of watch_config, -1 if none
+     *  @brief _config_file the file watched, both protected by _watch_mutex
      */
-    std::thread _daemon;
+    int _config_watch;
+    std::string _config_file;
+    std::mutex _watch_mutex;
 
-    /** @brief _thread_name is the map where correspondence
-     *  @brief thread_id <=> thread_name is stored
+    /** @brief _backends are the queues and their daemon, one by
+     *  @brief default, one per NUMA node after set_numa_backends.
+     *  @brief A producer always use the same backend (see local_backend)
+     *  @brief The set is replaced by restart_backends, and freed once
+     *  @brief the producers are out of their _grace reader section
      */
-    std::map<std::thread::id,std::string> _thread_name;
+    std::atomic<backend_set*> _backends;
+    log_grace _grace;
 
-    /** @brief _the write mutex of the logger
+    /** @brief _placement_mutex serialize the restarts and protect
+     *  @brief _cpu_affinity, the cpus of set_cpu_affinity
      */
-    std::mutex _write_mutex;
+    std::mutex _placement_mutex;
+    std::vector<int> _cpu_affinity;
 
-    /** @brief _data_available is notify by the print method of this class
-     * it will wake up the logging thread that will process log datas.
+    /** @brief _policy_mutex serialize the batches of the backends
+     *  @brief on the policy, only contended with several backends
      */
-    std::condition_variable _data_available;
+    std::mutex _policy_mutex;
 
-    /** @brief _log_buffer is the media between the current user 
-     *  @brief input operations and the daemon thread that perform
-     *  @brief output operations
+    /** @brief _scratch record given to the policies that don't accept
+     *  @brief views, reused so that its line is allocated once.
+     *  @brief Protected by _policy_mutex
      */
-    std::queue< std::string > _log_buffer;
+    log_record _scratch;
 
     /** @brief _policy pointer to the policy class which shall
      *  @brief inherit from log_policy_interface
@@ -311,11 +939,56 @@ private:
      */
     std::atomic<bool> _is_running;
 
+    /** @brief _stop_deadline see request_stop
+     *  @brief _dropped count of lines dropped at the deadline
+     *  @brief _daemons_running count of daemons not exited yet,
+     *  @brief notified with _shutdown_cv. Both never destroyed, as a
+     *  @brief daemon detached by shutdown_all may use them at exit
+     */
+    std::atomic<int64_t> _stop_deadline;
+    std::atomic<uint64_t> _dropped;
+    std::atomic<int> _daemons_running;
+    static std::mutex& _shutdown_mutex;
+    static std::condition_variable& _shutdown_cv;
+
+    /** @brief _exit_timeout timeout in ms of the exit handler
+     */
+    static std::atomic<int64_t> _exit_timeout;
+
+    /** @brief _executor resume the coroutines, see set_executor
+     *  @brief _async_queue_limit see set_async_queue_limit
+     */
+    std::atomic<log_executor*> _executor;
+    std::atomic<size_t> _async_queue_limit;
+
+    /** @brief _span_interval_ns interval of set_span_report, 0 if the
+     *  @brief scope timers are disabled. _span_target and _span_level
+     *  @brief where the reports are printed
+     */
+    std::atomic<int64_t> _span_interval_ns;
+    std::atomic<logger*> _span_target;
+    std::atomic<log_level> _span_level;
+
+    /** @brief _spans histogram of each site timed since the last report
+     *  @brief _span_last_report steady clock ns of the last report
+     *  @brief Both protected by _policy_mutex
+     */
+    std::map< const log_span_site*, log_span_histogram > _spans;
+    int64_t _span_last_report;
+
+    /** @brief _site_interval_ns and _site_burst_ns
+     *  @brief token bucket parameters of set_rate_limit,
+     *  @brief _site_interval_ns is 0 when rate limiting is disabled
+     */
+    std::atomic<int64_t> _site_interval_ns;
+    std::atomic<int64_t> _site_burst_ns;
+
     /** @brief _log_line_number is incremented each time
      *  @brief logger::print method is called, even if it is
-     *  @brief not printed in the user pattern
+     *  @brief not printed in the user pattern. Each line take its
+     *  @brief number with one fetch_add, without any lock
      */
-    unsigned int _log_line_number;
+    std::atomic<uint64_t> _log_line_number;
 
     /** @brief filename of log file
      *  @brief i.e. path + file
@@ -329,50 +1002,288 @@ private:
 
     /** @brief satic _logger_list
      *  @brief map all available logger instance
+     *  @brief never destroyed, so that a logger destroyed with the
+     *  @brief static objects (or the exit handler) can still use it
      *  @param key string "name" of the logger
      *  @param T logger* pointer to the logger
      */ 
-    static std::map<std::string, logger*> _logger_list;
+    static std::map<std::string, logger*>& _logger_list;
+
+    /** @brief _registry_mutex protect _logger_list and _default_logger
+     */
+    static std::mutex& _registry_mutex;
+};
+
+/** @brief log_site_printer is returned by logger::print_from
+ *  @brief it just hold the logger and the call site until the
+ *  @brief args are given, i.e. logger->LOG_INFO(args...)
+ */
+template< log_level severity >
+class log_site_printer
+{
+public:
+    log_site_printer(logger* log, log_site* site)
+        : _log(log), _site(site) { }
+
+    template< typename...Args >
+    void operator()(Args&&...args) {
+        _log->print_site(severity, _site, std::forward<Args>(args)...);
+    }
+private:
+    logger* _log;
+    log_site* _site;
+};
+
+/** @brief log_scope_timer is returned by logger::scope_timer, the
+ *  @brief span is pushed by its destructor. Inactive without logger
+ */
+class log_scope_timer
+{
+public:
+    log_scope_timer(logger* log, log_span_site* site)
+        : _log(log), _site(site), _start(log ? log_clock::now() : 0) { }
+
+    ~log_scope_timer() {
+        if (_log)
+            _log->push_span(_site, _start, log_clock::now());
+    }
+
+    log_scope_timer(const log_scope_timer&) = delete;
+    log_scope_timer& operator=(const log_scope_timer&) = delete;
+private:
+    logger* _log;
+    log_span_site* _site;
+    uint64_t _start;
+};
+
+#ifdef LOGGER_COROUTINES
+/** @brief log_flush_awaiter is returned by logger::flush_async
+ */
+class log_flush_awaiter
+{
+public:
+    explicit log_flush_awaiter(logger* log) : _log(log) { }
+
+    bool await_ready() const noexcept { return false; }
+
+    // The daemon may resume the coroutine before this return
+    void await_suspend(std::coroutine_handle<> handle) {
+        _log->when_flushed([handle] { handle.resume(); });
+    }
+
+    void await_resume() const noexcept { }
+private:
+    logger* _log;
 };
 
+/** @brief log_print_awaiter is returned by logger::print_async, args
+ *  @brief are kept by reference, they live until the end of co_await
+ */
+template< typename...Args >
+class log_print_awaiter
+{
+public:
+    log_print_awaiter(logger* log, log_level severity, Args&&...args)
+        : _log(log), _severity(severity),
+          _args(std::forward<Args>(args)...) { }
+
+    bool await_ready() const noexcept {
+        return _log->_async_queue_limit.load(std::memory_order_relaxed) == 0;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        return _log->when_queue_space([handle] { handle.resume(); });
+    }
+
+    void await_resume() {
+        std::apply([this](auto&&...args) {
+            _log->print(_severity, std::forward<decltype(args)>(args)...);
+        }, std::move(_args));
+    }
+private:
+    logger* _log;
+    log_level _severity;
+    std::tuple<Args&&...> _args;
+};
+
+inline log_flush_awaiter logger::flush_async()
+{
+    return log_flush_awaiter(this);
+}
+
+template< typename...Args >
+log_print_awaiter<Args...> logger::print_async(log_level severity, Args&&...args)
+{
+    return log_print_awaiter<Args...>(this, severity, std::forward<Args>(args)...);
+}
+#endif
+
 template< log_level severity ,typename...Args >
 void logger::print(Args&&...args)
 {
     print(severity, std::move(args)...);
 }
 
+template< typename...Args >
+std::future<void> logger::print_durable(log_level severity, Args&&...args)
+{
+    std::promise<void> durable;
+    std::future<void> result = durable.get_future();
+
+    log_grace::reader guard(_grace);
+    print(severity, std::forward<Args>(args)...);
+
+    // Registered after the line is queued, in the backend of this thread
+    // in the current set: the line is in the same backend, or in a
+    // previous set, drained before the daemons of this one start
+    backend& back = local_backend();
+    {
+        std::scoped_lock<std::mutex> lock(back.write_mutex);
+        back.sync_waiters.push_back(std::move(durable));
+    }
+    back.data_available.notify_one();
+    return result;
+}
+
+template< log_level severity >
+log_site_printer<severity> logger::print_from(log_site* site)
+{
+    return log_site_printer<severity>(this, site);
+}
+
+inline log_scope_timer logger::scope_timer(log_span_site* site)
+{
+    bool enabled = _span_interval_ns.load(std::memory_order_relaxed) != 0;
+    return log_scope_timer(enabled ? this : nullptr, site);
+}
+
+inline bool logger::site_enabled(log_level severity, log_site* site)
+{
+    // A stale tag only delay a level change a bit, resolve_site_level
+    // load it again with acquire before the config
+    uint64_t cache = site->level_cache();
+
+    if ((cache & ~(uint64_t)0xff) != _site_tag.load(std::memory_order_relaxed))
+        cache = resolve_site_level(site);
+    return (int)severity >= (int)(cache & 0xff);
+}
+
+template< typename...Args >
+void logger::print_site(log_level severity, log_site* site, Args&&...args)
+{
+    if(!site_enabled(severity, site)){
+        return;//Level too low
+    }
+
+    log_grace::reader guard(_grace);    // config and queue, see update_config
+    const config& conf = *_config.load(std::memory_order_acquire);
+    int64_t interval = _site_interval_ns.load(std::memory_order_relaxed);
+    if(interval) {
+        if(!site->admit(log_site::now_ns(), interval,
+                    _site_burst_ns.load(std::memory_order_relaxed))) {
+            site->suppress();
+            return; // Dropped, nothing has been formatted
+        }
+        uint64_t suppressed = site->take_suppressed();
+        if(suppressed)
+            print_line(severity, conf, "last message repeated ", suppressed,
+                    " times (", site->file(), ":", site->line(), ")");
+    }
+    print_line(severity, conf, std::forward<Args>(args)...);
+}
+
 template< typename...Args >
 void logger::print(log_level severity, Args&&...args)
 {
-    if(severity < _min_log_level){
+    log_grace::reader guard(_grace);    // config and queue, see update_config
+    // One snapshot for the whole line, see update_config
+    const config& conf = *_config.load(std::memory_order_acquire);
+
+    if(severity < conf.min_log_level){
         return;//Level too low
     }
-    std::stringstream log_stream;
+    print_line(severity, conf, std::forward<Args>(args)...);
+}
 
-    // Acquire the mutex to protect header mixing in case of multithreaded app
-    std::scoped_lock<std::mutex> guard(_print_mutex);
+template< typename...Args >
+void logger::print_line(log_level severity, const config& conf, Args&&...args)
+{
+    line_buffer buffer;
+    std::string& line = buffer.str();
+    // Even if no output, increment line number
+    header_fields fields = { conf, severity,
+            _log_line_number.fetch_add(1, std::memory_order_relaxed) + 1,
+            log_clock::now() };
 
-    _current_level = severity; // Pass arg to the header built funct
-    _log_line_number++; // Even if no output, increment line number
+    if (conf.format == output_format::json) {
+        print_json(fields, line, std::forward<Args>(args)...);
+        return;
+    }
 
     /* Build the header by pushing user char 
      * and calling func stored in _header pattern
      */
-    for (auto it_header = _header_pattern.begin(); 
-            it_header < _header_pattern.end(); ++it_header) 
-        log_stream << it_header->first << (this->*(it_header->second))();
-  
-    print_impl(std::forward<std::stringstream>(log_stream),
-               std::move(args)...);
+    for (auto it_header = conf.header_pattern.begin(); 
+            it_header < conf.header_pattern.end(); ++it_header) 
+    {
+        line.append(it_header->first);
+        (this->*(it_header->second))(line, fields);
+    }
+
+    // A literal message is not copied, see log_record
+    if constexpr (log_first_literal<Args...>::value) {
+        size_t offset = line.size();
+        const char* literal = append_literal_message(line, args...);
+        print_impl(fields, line, literal, offset);
+    } else {
+        log_append_message(line, args...);
+        print_impl(fields, line);
+    }
+}
+
+template< size_t N, typename...Args >
+const char* logger::append_literal_message(std::string& line,
+                            const char (&first)[N], const Args&...args)
+{
+    if (!log_static_storage(first)) {
+        log_append_message(line, first, args...);
+        return nullptr;
+    }
+    log_append_message(line, args...);
+    return first;
 }
 
-template< typename First, typename...Rest >
-void logger::print_impl(std::stringstream&& log_stream,
-                                      First&& parm1,Rest&&...parm)
+template< typename...Args >
+void logger::print_json(const header_fields& fields, std::string& line,
+                        Args&&...args)
 {
-    log_stream << parm1;
-    print_impl(std::forward<std::stringstream>(log_stream),
-               std::move(parm)...);
+    json_writer json(line);
+
+    json_header(line, fields);
+
+    // Plain args are concatenated in msg, kv args are typed fields
+    json.key("msg");
+    json.raw('"');
+    size_t msg_start = line.size();
+    if constexpr ((is_log_fmt< std::decay_t<Args> >::value || ...))
+        log_append_message(line, args...); // all args are in the format
+    else
+        ([&line](const auto& arg) {
+            if constexpr (!is_log_kv< std::decay_t<decltype(arg)> >::value)
+                log_append(line, arg);
+        }(args), ...);
+    json.escape_from(msg_start);
+    json.raw('"');
+
+    ([&json](const auto& arg) {
+        if constexpr (is_log_kv< std::decay_t<decltype(arg)> >::value) {
+            json.key(arg.key);
+            json.value(arg.value);
+        }
+    }(args), ...);
+    json.raw("}\n");
+
+    push_line(fields, line);
 }
 
 
@@ -21,6 +21,9 @@ void write_thread(const log_level loglevel, const std::string& thread_name)
 }
 
 int main(){
+    /* On crash, pending lines and a backtrace are written on stderr */
+    logger::install_crash_handler();
+
     logger *rogue_one = new logger(new file_log_policy(), 
                             "logs/execution.log");
     logger *rogue_two = new logger(new stdout_log_policy(),
@@ -60,6 +63,24 @@ int main(){
     rogue_two->LOG_ERROR("Don't panic");
     rogue_two->LOG_CRITICAL("But ", 0.5, " cast");
 
+    /* Each call site could log 5 lines at once, then 1 per second */
+    rogue_two->set_rate_limit(1, 5);
+    for(int i=0 ; i<100; i++)
+        rogue_two->LOG_WARNING("Flooding the logger #", i);
+    rogue_two->set_rate_limit(0);
+
+    /* Structured fields, rendered as " key=value" or as JSON fields */
+    rogue_two->LOG_INFO("Request served", kv("user", 42), kv("us", 12.5));
+    rogue_two->set_output_format(output_format::json);
+    rogue_two->LOG_INFO("Request \"served\"", kv("user", "marvin"),
+                            kv("us", 12.5), kv("cached", true));
+    rogue_two->set_output_format(output_format::text);
+
+    /* Format string checked at compile time, {:x} with a string
+     * or a missing arg won't compile */
+    rogue_two->LOG_NOTICE(LOG_FMT("{} took {:.3f} ms, status 0x{:X}"),
+                            "query", 1.23456, 255);
+
     for(int i=0 ; i<10000; i++)
         rogue_three->LOG_DEBUG("This is the #", i, " record");
 
@@ -0,0 +1,85 @@
+/*
+ * record_ring.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "record_ring.hpp"
+#include "cpu_topology.hpp"
+
+#include <cstring>
+
+static uint64_t align_record(uint64_t len)
+{
+    return (sizeof(record_ring_header) + len + RECORD_RING_ALIGN - 1) &
+                                            ~(uint64_t)(RECORD_RING_ALIGN - 1);
+}
+
+/* Bound to the node with libnuma, otherwise the pages are touched by
+ * the first lines, from the node of the producers */
+record_ring::record_ring(size_t capacity, int node):
+    _node(node), _head(0), _tail(0)
+{
+    uint64_t cap = 4096;
+    while (cap < capacity)
+        cap <<= 1;
+    _data = static_cast<char*>(alloc_on_node(cap, node));
+    _mask = cap - 1;
+}
+
+record_ring::~record_ring()
+{
+    free_on_node(_data, _mask + 1, _node);
+}
+
+bool record_ring::push(const log_record_view& record)
+{
+    uint64_t capacity = _mask + 1;
+    uint64_t size = align_record(record.line.size());
+    if (size > capacity / 4)
+        return false;
+
+    // Up to the end of the ring, at least RECORD_RING_ALIGN bytes
+    uint64_t room = capacity - (_tail & _mask);
+    uint64_t needed = size + (room < size ? room : 0);
+    if (_tail + needed - _head > capacity)
+        return false;
+
+    // size and length fit in RECORD_RING_ALIGN bytes
+    if (room < size) {
+        record_ring_header* padding = reinterpret_cast<record_ring_header*>(
+                                                    _data + (_tail & _mask));
+        padding->size = room;
+        padding->length = RECORD_RING_PADDING;
+        _tail += room;
+    }
+
+    record_ring_header* header = reinterpret_cast<record_ring_header*>(
+                                                    _data + (_tail & _mask));
+    header->size = size;
+    header->length = record.line.size();
+    header->literal_offset = record.literal_offset;
+    header->level = (uint8_t)record.level;
+    header->is_span = record.span != nullptr;
+    header->timestamp = record.timestamp;
+    if (record.span) {
+        header->span = record.span;
+        header->duration = record.duration;
+    } else {
+        header->literal = record.literal;
+        header->sequence = record.sequence;
+    }
+    memcpy(header + 1, record.line.data(), record.line.size());
+    _tail += size;
+    return true;
+}
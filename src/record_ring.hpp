@@ -0,0 +1,148 @@
+#pragma once
+/*
+ * record_ring.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "log_record.hpp"
+
+/**
+ * @brief Queue of a logger backend: a contiguous byte ring, each record
+ * @brief is copied in place by the producer, then read sequentially by
+ * @brief the daemon, so a line cost no allocation on both sides.
+ * @brief Each record is a record_ring_header followed by the line,
+ * @brief padded to RECORD_RING_ALIGN. Like shm_ring, a record never
+ * @brief wrap, a padding record fill the end of the ring instead.
+ * @brief Not thread safe: the producers push under the backend lock.
+ * @brief The daemon read [head, tail), tail taken under this lock, and
+ * @brief release it once written. Producers never write in this range
+ */
+#define RECORD_RING_ALIGN       8
+#define RECORD_RING_PADDING     0xffffffffU     // length of a padding record
+
+/**
+ * @brief RECORD_RING_SIZE bytes of the queue of a backend. A line bigger
+ * @brief than a quarter of it, or pushed when it is full, go to the
+ * @brief overflow queue of the backend (see logger::push_line)
+ */
+#define RECORD_RING_SIZE        (1 << 20)
+
+/**
+ * @brief A span (see LOG_SCOPE_TIMER) has no line, its site and its
+ * @brief duration take the place of the literal and of the sequence
+ */
+struct record_ring_header
+{
+    uint32_t size;              // bytes of the record, padding included
+    uint32_t length;            // bytes of the line, or RECORD_RING_PADDING
+    uint32_t literal_offset;
+    uint8_t level;
+    uint8_t is_span;
+    uint8_t reserved[2];
+    union {
+        const char* literal;
+        const log_span_site* span;
+    };
+    uint64_t timestamp;
+    union {
+        uint64_t sequence;
+        uint64_t duration;
+    };
+};
+
+static_assert(sizeof(record_ring_header) % RECORD_RING_ALIGN == 0,
+                "record_ring_header shall be aligned");
+
+class record_ring
+{
+public:
+    /** @param capacity bytes, rounded up to a power of 2
+     *  @param node NUMA node the ring is allocated on, -1 for any
+     *  @brief (see alloc_on_node)
+     */
+    explicit record_ring(size_t capacity = RECORD_RING_SIZE, int node = -1);
+    ~record_ring();
+
+    record_ring(const record_ring&) = delete;
+    record_ring& operator=(const record_ring&) = delete;
+
+    /** @brief push() copy a record at the tail
+     *  @return false if there is not enough room
+     */
+    bool push(const log_record_view& record);
+
+    /** @brief release() free the records before pos, once written
+     */
+    void release(uint64_t pos) { _head = pos; }
+
+    /** @brief head() and tail() absolute positions of the records
+     */
+    uint64_t head() const { return _head; }
+    uint64_t tail() const { return _tail; }
+    bool empty() const { return _head == _tail; }
+
+    /** @brief for_each() call f(const log_record_view&) for each record
+     *  @brief of [from, to), in their order. Allocation free, so that
+     *  @brief the crash handler can use it
+     */
+    template< typename F >
+    void for_each(uint64_t from, uint64_t to, F&& f) const;
+
+private:
+    const record_ring_header* at(uint64_t pos) const {
+        return reinterpret_cast<const record_ring_header*>(_data + (pos & _mask));
+    }
+
+    char* _data;
+    uint64_t _mask;
+    int _node;
+    uint64_t _head;
+    uint64_t _tail;
+};
+
+template< typename F >
+void record_ring::for_each(uint64_t from, uint64_t to, F&& f) const
+{
+    log_record_view record;
+
+    while (from < to) {
+        const record_ring_header* header = at(from);
+        if (header->size == 0)      // only if corrupted, i.e. crash handler
+            return;
+        from += header->size;
+        if (header->length == RECORD_RING_PADDING)
+            continue;
+
+        record.level = (log_level)header->level;
+        record.line = std::string_view(reinterpret_cast<const char*>(header + 1),
+                                       header->length);
+        record.timestamp = header->timestamp;
+        if (header->is_span) {
+            record.sequence = 0;
+            record.literal = nullptr;
+            record.span = header->span;
+            record.duration = header->duration;
+        } else {
+            record.sequence = header->sequence;
+            record.literal = header->literal;
+            record.span = nullptr;
+            record.duration = 0;
+        }
+        record.literal_offset = header->literal_offset;
+        f(record);
+    }
+}
@@ -0,0 +1,264 @@
+/*
+ * shm_ring.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "shm_ring.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t align_record(uint64_t len)
+{
+    return (sizeof(shm_ring_record) + len + SHM_RING_ALIGN - 1) &
+                                                    ~(uint64_t)(SHM_RING_ALIGN - 1);
+}
+
+/* The records start on the next cache line after the header */
+static size_t data_offset()
+{
+    return (sizeof(shm_ring_header) + 63) & ~(size_t)63;
+}
+
+/**
+* -----------------Implementation for shm_ring_writer-------------------------
+*/
+
+shm_ring_writer::shm_ring_writer(): _header(nullptr), _data(nullptr),
+                                    _map_size(0), _pos(0), _seq(0) { }
+
+shm_ring_writer::~shm_ring_writer() {
+    close();
+}
+
+bool shm_ring_writer::open(const std::string& name, uint64_t capacity) {
+    uint64_t cap = 4096;
+    struct stat st;
+
+    while (cap < capacity)
+        cap <<= 1;
+
+    _name = name;
+    _map_size = data_offset() + cap;
+
+    int fd = shm_open(_name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    /* A segment with another size may be mapped by a reader,
+     * don't resize it under its feet, start a new one */
+    if (fstat(fd, &st) == 0 && st.st_size != 0 &&
+                                    (size_t)st.st_size != _map_size) {
+        ::close(fd);
+        shm_unlink(_name.c_str());
+        fd = shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+            return false;
+    }
+
+    if (ftruncate(fd, _map_size) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* addr = mmap(nullptr, _map_size, PROT_READ | PROT_WRITE,
+                                                    MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    _header = new (addr) shm_ring_header;
+    _data = static_cast<char*>(addr) + data_offset();
+
+    /* Invalidate, fill, then publish the header */
+    _header->magic.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _header->version = SHM_RING_VERSION;
+    _header->capacity = cap;
+    _header->epoch = std::chrono::steady_clock::now().time_since_epoch().count();
+    _header->reserve_pos.store(0, std::memory_order_relaxed);
+    _header->write_pos.store(0, std::memory_order_relaxed);
+    _header->last_pos.store(0, std::memory_order_relaxed);
+    _header->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+
+    _pos = 0;
+    _seq = 0;
+    return true;
+}
+
+void shm_ring_writer::close(bool unlink) {
+    if (_header) {
+        munmap(_header, _map_size);
+        _header = nullptr;
+        _data = nullptr;
+        if (unlink)
+            shm_unlink(_name.c_str());
+    }
+}
+
+void shm_ring_writer::write(const char* data, size_t len) {
+    if (!_header)
+        return;
+
+    uint64_t cap = _header->capacity;
+    if (len > cap / 2 - sizeof(shm_ring_record))
+        len = cap / 2 - sizeof(shm_ring_record);
+
+    uint64_t size = align_record(len);
+    uint64_t offset = _pos & (cap - 1);
+    uint64_t padding = (offset + size > cap) ? cap - offset : 0;
+
+    /* Tell the readers which area will be overwritten,
+     * before touching it (seqlock like) */
+    _header->reserve_pos.store(_pos + padding + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (padding) {
+        shm_ring_record pad = { _seq, 0, SHM_RING_PADDING };
+        memcpy(_data + offset, &pad, sizeof(pad));
+        _pos += padding;
+        offset = 0;
+    }
+
+    shm_ring_record rec = { _seq++, (uint32_t)len, 0 };
+    memcpy(_data + offset, &rec, sizeof(rec));
+    memcpy(_data + offset + sizeof(rec), data, len);
+
+    _header->last_pos.store(_pos, std::memory_order_relaxed);
+    _pos += size;
+    _header->write_pos.store(_pos, std::memory_order_release);
+}
+
+/**
+* -----------------Implementation for shm_ring_reader-------------------------
+*/
+
+shm_ring_reader::shm_ring_reader(): _header(nullptr), _data(nullptr),
+                    _map_size(0), _epoch(0), _pos(0), _next_seq(0) { }
+
+shm_ring_reader::~shm_ring_reader() {
+    close();
+}
+
+bool shm_ring_reader::open(const std::string& name, bool from_start) {
+    struct stat st;
+
+    close();
+    _name = name;
+
+    int fd = shm_open(_name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size <= data_offset()) {
+        ::close(fd);
+        return false;
+    }
+
+    _map_size = st.st_size;
+    void* addr = mmap(nullptr, _map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    _header = static_cast<const shm_ring_header*>(addr);
+    _data = static_cast<const char*>(addr) + data_offset();
+
+    if (_header->magic.load(std::memory_order_acquire) != SHM_RING_MAGIC ||
+            _header->version != SHM_RING_VERSION ||
+            data_offset() + _header->capacity != _map_size) {
+        close();
+        return false;
+    }
+
+    restart();
+    if (!from_start) {
+        _pos = _header->write_pos.load(std::memory_order_acquire);
+        _next_seq = UINT64_MAX;     // set by the first record
+    }
+    return true;
+}
+
+void shm_ring_reader::close() {
+    if (_header) {
+        munmap(const_cast<shm_ring_header*>(_header), _map_size);
+        _header = nullptr;
+        _data = nullptr;
+    }
+}
+
+void shm_ring_reader::restart() {
+    _epoch = _header->epoch;
+    _pos = 0;
+    _next_seq = 0;
+}
+
+bool shm_ring_reader::read(std::string& msg, uint64_t& lost) {
+    lost = 0;
+    if (!_header)
+        return false;
+
+    for (;;) {
+        if (_header->magic.load(std::memory_order_acquire) != SHM_RING_MAGIC)
+            return false;   // writer is restarting
+        if (_header->epoch != _epoch)
+            restart();
+
+        uint64_t cap = _header->capacity;
+        uint64_t write_pos = _header->write_pos.load(std::memory_order_acquire);
+
+        if (write_pos == _pos)
+            return false;
+
+        if (write_pos < _pos || write_pos - _pos > cap) {
+            // overrun, restart on the last record
+            _pos = _header->last_pos.load(std::memory_order_acquire);
+            continue;
+        }
+
+        shm_ring_record rec;
+        uint64_t offset = _pos & (cap - 1);
+        memcpy(&rec, _data + offset, sizeof(rec));
+
+        uint64_t size = (rec.flags & SHM_RING_PADDING) ? cap - offset :
+                                                        align_record(rec.len);
+        bool valid = offset + size <= cap;
+        if (valid && !(rec.flags & SHM_RING_PADDING))
+            msg.assign(_data + offset + sizeof(rec), rec.len);
+
+        /* If the writer has reserved this area meanwhile,
+         * what we have just copied may be garbage */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t reserve_pos = _header->reserve_pos.load(std::memory_order_relaxed);
+        if (!valid || reserve_pos - _pos > cap) {
+            _pos = _header->last_pos.load(std::memory_order_acquire);
+            continue;
+        }
+
+        _pos += size;
+        if (rec.flags & SHM_RING_PADDING)
+            continue;
+
+        if (_next_seq != UINT64_MAX && rec.seq > _next_seq)
+            lost += rec.seq - _next_seq;
+        _next_seq = rec.seq + 1;
+        return true;
+    }
+}
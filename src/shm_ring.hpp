@@ -0,0 +1,147 @@
+#pragma once
+/*
+ * shm_ring.hpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief POSIX shared memory ring buffer, used by shm_log_policy
+ * @brief to hand log lines to a collector process without any file
+ * @brief or socket I/O. One writer (the logger daemon) per ring,
+ * @brief any count of readers, which never block the writer: a reader
+ * @brief too slow is overrun, and it is detected with the sequence
+ * @brief number of each record.
+ * @brief Layout: shm_ring_header, then capacity bytes of records.
+ * @brief Each record is a shm_ring_record followed by the message,
+ * @brief padded to SHM_RING_ALIGN. A record never wrap, a padding
+ * @brief record fill the end of the ring instead.
+ */
+#define SHM_RING_MAGIC      0x52474f4cU     // "LOGR"
+#define SHM_RING_VERSION    1
+#define SHM_RING_ALIGN      16
+
+/** @brief shm_ring_header is at the beginning of the segment
+ */
+struct shm_ring_header
+{
+    std::atomic<uint32_t> magic;    // set last, once the header is valid
+    uint32_t version;
+    uint64_t capacity;              // bytes of records, power of 2
+    uint64_t epoch;                 // change each time the writer restart
+
+    /** @brief reserve_pos is stored before a record is written
+     *  @brief write_pos after, so the reader can detect an overwrite.
+     *  @brief last_pos is the position of the last record, where
+     *  @brief an overrun reader restart. All are absolute positions
+     */
+    alignas(64) std::atomic<uint64_t> reserve_pos;
+    std::atomic<uint64_t> write_pos;
+    std::atomic<uint64_t> last_pos;
+};
+
+struct shm_ring_record
+{
+    uint64_t seq;       // record number, since the writer started
+    uint32_t len;       // message length, without padding
+    uint32_t flags;     // SHM_RING_PADDING
+};
+
+#define SHM_RING_PADDING    1
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "shm_ring require lock free 64 bits atomics");
+static_assert(sizeof(shm_ring_record) % SHM_RING_ALIGN == 0,
+                "shm_ring_record shall be aligned");
+
+/**
+ * @brief shm_ring_writer the producer side
+ */
+class shm_ring_writer
+{
+public:
+    shm_ring_writer();
+    ~shm_ring_writer();
+
+    /** @brief open() create (or reuse) and map the segment
+     *  @param name shm name, i.e. "/my_logger"
+     *  @param capacity bytes, rounded up to a power of 2
+     *  @return false on failure
+     */
+    bool open(const std::string& name, uint64_t capacity);
+
+    /** @brief close() unmap the segment
+     *  @param unlink remove the name (readers keep their mapping)
+     */
+    void close(bool unlink = false);
+
+    /** @brief write() copy one message in the ring. Message bigger
+     *  @brief than half of the ring are truncated
+     */
+    void write(const char* data, size_t len);
+
+    bool is_open() const { return _header != nullptr; }
+
+private:
+    std::string _name;
+    shm_ring_header* _header;
+    char* _data;
+    size_t _map_size;
+    uint64_t _pos;      // local copy of write_pos
+    uint64_t _seq;
+};
+
+/**
+ * @brief shm_ring_reader the consumer side, used by the collector
+ */
+class shm_ring_reader
+{
+public:
+    shm_ring_reader();
+    ~shm_ring_reader();
+
+    /** @brief open() map an existing segment, read only
+     *  @param from_start read what is already in the ring, otherwise
+     *  @brief only the records written after open
+     *  @return false if the segment doesn't exist or is not valid
+     */
+    bool open(const std::string& name, bool from_start = true);
+    void close();
+
+    /** @brief read() get the next record, never block
+     *  @param msg the message of the record
+     *  @param lost count of records overwritten before this one
+     *  @return true if a record has been read, false if none available
+     */
+    bool read(std::string& msg, uint64_t& lost);
+
+    bool is_open() const { return _header != nullptr; }
+    const std::string& name() const { return _name; }
+
+private:
+    /** @brief restart() go back to the start when the writer restart
+     */
+    void restart();
+
+    std::string _name;
+    const shm_ring_header* _header;
+    const char* _data;
+    size_t _map_size;
+    uint64_t _epoch;
+    uint64_t _pos;
+    uint64_t _next_seq;
+};
@@ -0,0 +1,79 @@
+/*
+ * log_decode.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Print the lines of a binary log file (binary_file_log_policy) as
+ * text, the literal messages are taken from the string table.
+ *
+ * Usage: log_decode [-s] file
+ *     -s   print the string table and its savings on stderr
+ */
+
+#include "log_binary.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    bool stats = false;
+    const char* filename = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0)
+            stats = true;
+        else
+            filename = argv[i];
+    }
+    if (filename == nullptr) {
+        fprintf(stderr, "Usage: %s [-s] file\n", argv[0]);
+        return 1;
+    }
+
+    log_binary_reader reader;
+    if (!reader.open(filename)) {
+        fprintf(stderr, "%s: not a binary log file\n", filename);
+        return 1;
+    }
+
+    log_binary_line line;
+    uint64_t lines = 0;
+    std::vector<uint64_t> uses;
+    while (reader.next(line)) {
+        fwrite(line.text.data(), 1, line.text.size(), stdout);
+        lines++;
+        if (line.string_id > 0) {
+            if (uses.size() < line.string_id)
+                uses.resize(line.string_id);
+            uses[line.string_id - 1]++;
+        }
+    }
+
+    if (stats) {
+        // The table of the last session only
+        const std::vector<std::string>& strings = reader.strings();
+        for (size_t i = 0; i < strings.size(); i++)
+            fprintf(stderr, "%zu\t%llu\t%s\n", i + 1,
+                    (unsigned long long)(i < uses.size() ? uses[i] : 0),
+                    strings[i].c_str());
+        fprintf(stderr, "%llu lines, string table %llu bytes for %llu bytes of literals\n",
+                (unsigned long long)lines,
+                (unsigned long long)reader.string_bytes(),
+                (unsigned long long)reader.literal_bytes());
+    }
+    return 0;
+}
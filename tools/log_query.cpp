@@ -0,0 +1,221 @@
+/*
+ * log_query.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Query a log file with its index (see set_index): only the blocks
+ * overlapping the time range, and holding lines of the level, are
+ * read. The time filter is done per block, not per line, as the
+ * header pattern is free: lines a bit outside the range may be
+ * printed. The level filter look for the level name in each line.
+ * The lines after the last entry of the index are not indexed, they
+ * are always read.
+ *
+ * Usage: log_query [--from T] [--to T] [--level L] [--list] file
+ *     --from, --to T   seconds since the epoch, or "YYYY-mm-dd HH:MM:SS"
+ *                      in local time
+ *     --level L        debug, info, notice, warning, error or critical,
+ *                      print the lines of this level and above
+ *     --list           print the index instead of the lines
+ */
+
+#include "log_index.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <strings.h>
+
+static const char* level_names[LOG_INDEX_LEVELS] = {
+    "DEBUG", "INFO", "NOTICE", "WARNING", "ERROR", "CRITICAL"
+};
+
+static bool parse_time(const char* text, int64_t& ns)
+{
+    char* end;
+    long long seconds = strtoll(text, &end, 10);
+
+    if (*end == '\0' && end != text) {
+        ns = seconds * 1000000000;
+        return true;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(text, "%Y-%m-%d %H:%M:%S", &tm);
+    if (end == nullptr || *end != '\0')
+        return false;
+    tm.tm_isdst = -1;
+    ns = (int64_t)mktime(&tm) * 1000000000;
+    return true;
+}
+
+static int parse_level(const char* text)
+{
+    for (int i = 0; i < LOG_INDEX_LEVELS; i++)
+        if (strcasecmp(text, level_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+static bool is_word_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/* The level of a line is the first level name found as a word */
+static int line_level(const std::string& line)
+{
+    for (size_t pos = 0; pos < line.size(); pos++) {
+        if (!isupper((unsigned char)line[pos]) ||
+                (pos > 0 && is_word_char(line[pos - 1])))
+            continue;
+        for (int i = 0; i < LOG_INDEX_LEVELS; i++) {
+            size_t len = strlen(level_names[i]);
+            if (line.compare(pos, len, level_names[i]) == 0 &&
+                    (pos + len == line.size() || !is_word_char(line[pos + len])))
+                return i;
+        }
+    }
+    return -1;
+}
+
+static bool block_has_level(const log_index_entry& entry, int min_level)
+{
+    for (int i = min_level; i < LOG_INDEX_LEVELS; i++)
+        if (entry.level_count[i])
+            return true;
+    return false;
+}
+
+/* Print the lines of [offset, offset + length), length 0 up to the end */
+static void print_lines(std::ifstream& file, uint64_t offset, uint64_t length,
+                        int min_level)
+{
+    std::string line;
+    uint64_t read = 0;
+
+    file.clear();
+    file.seekg(offset);
+    while ((length == 0 || read < length) && std::getline(file, line)) {
+        read += line.size() + 1;
+        if (min_level > 0) {
+            int level = line_level(line);
+            // Continuation of a multi line message: keep it with its line
+            if (level >= 0 && level < min_level)
+                continue;
+        }
+        fwrite(line.data(), 1, line.size(), stdout);
+        fputc('\n', stdout);
+    }
+}
+
+static void print_time(int64_t ns)
+{
+    time_t seconds = ns / 1000000000;
+    struct tm tm;
+    char text[32];
+
+    localtime_r(&seconds, &tm);
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06lld", text, (long long)(ns % 1000000000) / 1000);
+}
+
+static void list_index(const std::vector<log_index_entry>& entries)
+{
+    printf("offset\tlength\tsequence\tearliest\t\t\tlatest\t\t\t\tlines per level\n");
+    for (const log_index_entry& entry : entries) {
+        printf("%llu\t%llu\t%llu\t", (unsigned long long)entry.offset,
+               (unsigned long long)entry.length,
+               (unsigned long long)entry.min_sequence);
+        print_time(entry.min_ns);
+        printf("\t");
+        print_time(entry.max_ns);
+        for (int i = 0; i < LOG_INDEX_LEVELS; i++)
+            printf("%s%u", i ? "/" : "\t", entry.level_count[i]);
+        printf("\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    int min_level = 0;
+    bool list = false;
+    std::string filename;
+    bool usage = false;
+
+    for (int i = 1; i < argc && !usage; i++) {
+        if (strcmp(argv[i], "--from") == 0 && i + 1 < argc)
+            usage = !parse_time(argv[++i], from);
+        else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc)
+            usage = !parse_time(argv[++i], to);
+        else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+            usage = (min_level = parse_level(argv[++i])) < 0;
+        else if (strcmp(argv[i], "--list") == 0)
+            list = true;
+        else if (argv[i][0] != '-' && filename.empty())
+            filename = argv[i];
+        else
+            usage = true;
+    }
+    if (usage || filename.empty()) {
+        fprintf(stderr, "Usage: %s [--from T] [--to T] [--level L] [--list] file\n"
+                "    T: seconds since the epoch or \"YYYY-mm-dd HH:MM:SS\"\n"
+                "    L: debug, info, notice, warning, error or critical\n",
+                argv[0]);
+        return 1;
+    }
+
+    log_index_header header;
+    std::vector<log_index_entry> entries;
+    if (!log_index_read(filename, header, entries)) {
+        fprintf(stderr, "%s%s: no valid index\n", filename.c_str(), LOG_INDEX_SUFFIX);
+        return 1;
+    }
+    if (list) {
+        list_index(entries);
+        return 0;
+    }
+
+    std::ifstream file(filename, std::ios_base::binary);
+    if (!file.is_open()) {
+        fprintf(stderr, "%s: %s\n", filename.c_str(), strerror(errno));
+        return 1;
+    }
+
+    uint64_t indexed_end = 0;
+    for (const log_index_entry& entry : entries) {
+        if (entry.offset + entry.length > indexed_end)
+            indexed_end = entry.offset + entry.length;
+        // Blocks overlapping [from, to], whatever the order of their lines
+        if (entry.max_ns < from || entry.min_ns > to ||
+                !block_has_level(entry, min_level))
+            continue;
+        print_lines(file, entry.offset, entry.length, min_level);
+    }
+
+    // The tail is not indexed yet (block in progress)
+    print_lines(file, indexed_end, 0, min_level);
+    return 0;
+}
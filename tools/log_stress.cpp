@@ -0,0 +1,441 @@
+/*
+ * log_stress.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Load generator: producer threads (in one or several processes) log
+ * lines of random size at a given rate in one logger, then the output
+ * is checked and the throughput and the latency of print are reported.
+ * Each line is "stress <process> <thread> <number> <size> <payload>",
+ * the payload depend on the number, so that a torn or mixed line is
+ * detected. The checks:
+ *  - no torn line, and the lines of a thread are in order
+ *  - file and direct: no line lost
+ *  - ringfile and segment: the lines lost are the oldest ones (the
+ *    lines of a thread found are its last ones, without gap), and no
+ *    file is bigger than max_size
+ * With -R, two more threads create and delete loggers meanwhile, and
+ * look them up: build with "make TSAN=1" to check the registry.
+ *
+ * Usage: log_stress [-P policy] [-t threads] [-p processes] [-n lines]
+ *                   [-s min[:max]] [-r rate] [-m max_size] [-c count]
+ *                   [-R] file
+ *     -P   file (default), direct, ringfile or segment. With several
+ *          processes, file or ringfile in shared mode (see set_shared)
+ *     -t   producer threads per process, default 4
+ *     -p   processes, default 1
+ *     -n   lines per thread, default 100000
+ *     -s   payload size in bytes, random in [min, max], default 100
+ *     -r   lines per second per thread, default 0 (no limit)
+ *     -m   max_size of the ringfile and segment files, default 1MB
+ *     -c   ringfile file count, default 4
+ *     -R   registry stress
+ */
+
+#include "logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+struct stress_options
+{
+    std::string policy = "file";
+    int threads = 4;
+    int processes = 1;
+    long lines = 100000;
+    size_t min_size = 100;
+    size_t max_size = 100;
+    long rate = 0;
+    uintmax_t file_size = 1048576;
+    int file_count = 4;
+    bool registry = false;
+    std::string filename;
+};
+
+static char payload_char(long number, size_t i)
+{
+    return 'a' + (number + i) % 26;
+}
+
+static log_policy_interface* make_policy(const stress_options& opt)
+{
+    bool shared = opt.processes > 1;
+
+    if (opt.policy == "direct")
+        return new direct_file_log_policy();
+    if (opt.policy == "segment")
+        return new segment_log_policy(opt.file_size, 0, (uintmax_t)-1);
+    if (opt.policy == "ringfile") {
+        ringfile_log_policy* ring = new ringfile_log_policy(opt.file_size,
+                                                            opt.file_count);
+        if (shared)
+            ring->set_shared();
+        return ring;
+    }
+    file_log_policy* file = new file_log_policy();
+    if (shared)
+        file->set_shared();
+    return file;
+}
+
+/* Create, look up and delete loggers until stop */
+static void registry_stress(const stress_options& opt, int id,
+                            const std::atomic<bool>& stop)
+{
+    std::string name = opt.filename + ".registry." + std::to_string(id);
+
+    while (!stop.load()) {
+        logger* log = new logger(new file_log_policy(), name);
+        log->set_thread_name("registry");
+        log->LOG_INFO("registry ", id);
+        logger::get_logger(opt.filename);
+        logger::loggername_exist(name);
+        logger::get_default_logger();
+        delete log;
+    }
+    std::error_code error;
+    fs::remove(name, error);
+}
+
+/* Run the threads of one process, return the latency of each print in ns */
+static std::vector<uint32_t> run_process(const stress_options& opt, int process)
+{
+    logger* log = new logger(make_policy(opt), opt.filename);
+    log->set_pattern("%d %t %l [%x] ");
+
+    std::vector< std::vector<uint32_t> > latencies(opt.threads);
+    std::vector<std::thread> threads;
+    std::vector<std::thread> registry;
+    std::atomic<bool> stop(false);
+
+    if (opt.registry)
+        for (int i = 0; i < 2; i++)
+            registry.emplace_back(registry_stress, std::cref(opt),
+                                  process * 2 + i, std::cref(stop));
+
+    for (int t = 0; t < opt.threads; t++)
+        threads.emplace_back([&opt, &latencies, log, process, t] {
+            std::vector<uint32_t>& latency = latencies[t];
+            std::string payload;
+            uint32_t random = 2463534242u + t;
+            auto start = std::chrono::steady_clock::now();
+
+            log->set_thread_name("stress-" + std::to_string(t));
+            latency.reserve(opt.lines);
+            for (long n = 0; n < opt.lines; n++) {
+                random ^= random << 13;
+                random ^= random >> 17;
+                random ^= random << 5;
+                size_t size = opt.min_size +
+                              random % (opt.max_size - opt.min_size + 1);
+                payload.resize(size);
+                for (size_t i = 0; i < size; i++)
+                    payload[i] = payload_char(n, i);
+
+                if (opt.rate > 0)
+                    std::this_thread::sleep_until(start +
+                            std::chrono::nanoseconds(n * 1000000000LL / opt.rate));
+
+                auto before = std::chrono::steady_clock::now();
+                log->LOG_INFO("stress ", process, " ", t, " ", n, " ", size, " ", payload);
+                latency.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - before).count());
+            }
+        });
+
+    for (auto& thread : threads)
+        thread.join();
+    stop.store(true);
+    for (auto& thread : registry)
+        thread.join();
+    delete log;
+
+    std::vector<uint32_t> all;
+    for (auto& latency : latencies)
+        all.insert(all.end(), latency.begin(), latency.end());
+    return all;
+}
+
+/* The log file, or the numbered files of ringfile and segment */
+static std::vector<std::string> output_files(const stress_options& opt)
+{
+    std::vector<std::string> files;
+
+    if (opt.policy != "ringfile" && opt.policy != "segment") {
+        files.push_back(opt.filename);
+        return files;
+    }
+
+    fs::path base(opt.filename);
+    std::string prefix = base.filename().string() + ".";
+    fs::path dir = base.parent_path().empty() ? fs::path(".") : base.parent_path();
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(dir, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) == 0 &&
+                name.size() > prefix.size() &&
+                name.find_first_not_of("0123456789", prefix.size()) == std::string::npos)
+            files.push_back(entry.path().string());
+    }
+    return files;
+}
+
+static void remove_output(const stress_options& opt)
+{
+    std::error_code error;
+
+    for (const std::string& file : output_files(opt)) {
+        fs::remove(file, error);
+        fs::remove(file + LOG_INDEX_SUFFIX, error);
+    }
+    fs::remove(opt.filename + ".lock", error);
+}
+
+/* Numbers of the lines found, per process and thread */
+typedef std::map< std::pair<int, int>, std::vector<long> > thread_lines;
+
+struct check_result
+{
+    long lines = 0;
+    long torn = 0;
+    long out_of_order = 0;
+    long lost = 0;
+    long oversized = 0;
+    uint64_t bytes = 0;
+};
+
+/* A line is "... stress <process> <thread> <number> <size> <payload>" */
+static void check_file(const std::string& filename,
+                       thread_lines& threads,
+                       check_result& result)
+{
+    std::ifstream file(filename);
+    std::string line;
+    std::map< std::pair<int, int>, long > last;
+
+    while (std::getline(file, line)) {
+        result.bytes += line.size() + 1;
+        size_t pos = line.find("stress ");
+        if (pos == std::string::npos) {
+            if (line.find("registry") == std::string::npos &&
+                    line.find("Logger activity") == std::string::npos)
+                result.torn++;
+            continue;
+        }
+
+        int process, thread;
+        long number;
+        size_t size;
+        int len = 0;
+        if (sscanf(line.c_str() + pos, "stress %d %d %ld %zu %n", &process,
+                            &thread, &number, &size, &len) != 4 ||
+                line.size() - pos - len != size) {
+            result.torn++;
+            continue;
+        }
+        const char* payload = line.c_str() + pos + len;
+        bool torn = false;
+        for (size_t i = 0; i < size && !torn; i++)
+            torn = payload[i] != payload_char(number, i);
+        if (torn) {
+            result.torn++;
+            continue;
+        }
+
+        // Order is checked in each file, the files may be read in any order
+        auto key = std::make_pair(process, thread);
+        auto it = last.find(key);
+        if (it != last.end() && number <= it->second)
+            result.out_of_order++;
+        last[key] = number;
+        threads[key].push_back(number);
+        result.lines++;
+    }
+}
+
+static check_result check_output(const stress_options& opt)
+{
+    thread_lines threads;
+    check_result result;
+    bool rotated = opt.policy == "ringfile" || opt.policy == "segment";
+
+    for (const std::string& file : output_files(opt)) {
+        check_file(file, threads, result);
+        std::error_code error;
+        if (rotated && fs::file_size(file, error) > opt.file_size &&
+                opt.max_size + 128 < opt.file_size)
+            result.oversized++;
+    }
+
+    for (int p = 0; p < opt.processes; p++) {
+        for (int t = 0; t < opt.threads; t++) {
+            auto it = threads.find(std::make_pair(p, t));
+            if (it == threads.end()) {
+                result.lost += rotated ? 0 : opt.lines;
+                continue;
+            }
+            std::vector<long>& numbers = it->second;
+            std::sort(numbers.begin(), numbers.end());
+            numbers.erase(std::unique(numbers.begin(), numbers.end()), numbers.end());
+
+            // Rotation only drop the oldest lines: from the first line
+            // found, all the lines shall be there
+            long first = rotated ? numbers.front() : 0;
+            result.lost += opt.lines - first - (long)numbers.size();
+        }
+    }
+    return result;
+}
+
+static void print_latency(std::vector<uint32_t>& latency)
+{
+    static const double percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+
+    if (latency.empty())
+        return;
+    std::sort(latency.begin(), latency.end());
+    printf("print latency:");
+    for (double p : percentiles) {
+        size_t index = std::min(latency.size() - 1,
+                                (size_t)(p / 100 * latency.size()));
+        printf(" p%g %.2f us,", p, latency[index] / 1000.0);
+    }
+    printf(" max %.2f us\n", latency.back() / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+    stress_options opt;
+    bool usage = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "P:t:p:n:s:r:m:c:R")) != -1) {
+        switch (c) {
+        case 'P': opt.policy = optarg; break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'p': opt.processes = atoi(optarg); break;
+        case 'n': opt.lines = atol(optarg); break;
+        case 's': {
+            char* end;
+            opt.min_size = opt.max_size = strtoul(optarg, &end, 10);
+            if (*end == ':')
+                opt.max_size = strtoul(end + 1, nullptr, 10);
+            break;
+        }
+        case 'r': opt.rate = atol(optarg); break;
+        case 'm': opt.file_size = strtoull(optarg, nullptr, 10); break;
+        case 'c': opt.file_count = atoi(optarg); break;
+        case 'R': opt.registry = true; break;
+        default: usage = true;
+        }
+    }
+    if (opt.policy != "file" && opt.policy != "direct" &&
+            opt.policy != "ringfile" && opt.policy != "segment")
+        usage = true;
+    if (opt.processes > 1 && opt.policy != "file" && opt.policy != "ringfile")
+        usage = true;
+    if (usage || optind + 1 != argc || opt.threads <= 0 || opt.processes <= 0 ||
+            opt.lines <= 0 || opt.max_size < opt.min_size || opt.file_count < 2) {
+        fprintf(stderr, "Usage: %s [-P file|direct|ringfile|segment] [-t threads] "
+                        "[-p processes] [-n lines] [-s min[:max]] [-r rate] "
+                        "[-m max_size] [-c count] [-R] file\n", argv[0]);
+        return 1;
+    }
+    opt.filename = argv[optind];
+    remove_output(opt);
+
+    std::vector<uint32_t> latency;
+    auto start = std::chrono::steady_clock::now();
+
+    if (opt.processes == 1) {
+        latency = run_process(opt, 0);
+    } else {
+        std::vector< std::pair<pid_t, int> > children;
+        for (int p = 0; p < opt.processes; p++) {
+            int fds[2];
+            if (pipe(fds) != 0) {
+                perror("pipe");
+                return 1;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                std::vector<uint32_t> samples = run_process(opt, p);
+                const char* data = reinterpret_cast<const char*>(samples.data());
+                size_t size = samples.size() * sizeof(uint32_t);
+                while (size > 0) {
+                    ssize_t n = write(fds[1], data, size);
+                    if (n <= 0)
+                        break;
+                    data += n;
+                    size -= n;
+                }
+                _exit(0);
+            }
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            }
+            close(fds[1]);
+            children.emplace_back(pid, fds[0]);
+        }
+        for (auto& child : children) {
+            uint32_t samples[4096];
+            ssize_t n;
+            while ((n = read(child.second, samples, sizeof(samples))) > 0)
+                latency.insert(latency.end(), samples, samples + n / sizeof(uint32_t));
+            close(child.second);
+            waitpid(child.first, nullptr, 0);
+        }
+    }
+    double elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+
+    check_result result = check_output(opt);
+    long total = opt.lines * opt.threads * opt.processes;
+
+    printf("%s: %d processes x %d threads, %ld lines of %zu to %zu bytes\n",
+           opt.policy.c_str(), opt.processes, opt.threads, total,
+           opt.min_size, opt.max_size);
+    // The lines dropped by rotation are not counted in MB/s
+    printf("%.3f s (written and closed), %.0f lines/s", elapsed, total / elapsed);
+    if (opt.policy != "ringfile" && opt.policy != "segment")
+        printf(", %.1f MB/s", result.bytes / elapsed / 1048576);
+    printf("\n");
+    print_latency(latency);
+    printf("lines read %ld, torn %ld, out of order %ld, lost %ld",
+           result.lines, result.torn, result.out_of_order, result.lost);
+    if (opt.policy == "ringfile" || opt.policy == "segment")
+        printf(" (but rotated), files over max_size %ld", result.oversized);
+    printf("\n");
+
+    return result.torn || result.out_of_order || result.lost ||
+           result.oversized ? 2 : 0;
+}
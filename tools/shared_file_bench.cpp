@@ -0,0 +1,197 @@
+/*
+ * shared_file_bench.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Several processes logging in the same file (see set_shared): report
+ * the throughput, then check that no line is torn or lost. With -r the
+ * processes share a ringfile_log_policy, lines are lost by rotation,
+ * only torn lines and the order are checked.
+ *
+ * Usage: shared_file_bench [-p processes] [-n lines] [-s size]
+ *                          [-r max_size] [-u] file
+ *     -p   processes, default 4
+ *     -n   lines per process, default 100000
+ *     -s   size of the message, default 200 bytes
+ *     -r   ringfile_log_policy of 4 files of max_size bytes
+ *     -u   not shared (default file_log_policy), to compare
+ */
+
+#include "logger.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define RING_FILE_COUNT 4
+
+namespace fs = std::filesystem;
+
+struct bench_options
+{
+    int processes = 4;
+    long lines = 100000;
+    size_t size = 200;
+    uintmax_t ring_size = 0;
+    bool shared = true;
+    std::string filename;
+};
+
+static void run_process(const bench_options& opt, int process)
+{
+    log_policy_interface* policy;
+
+    if (opt.ring_size) {
+        ringfile_log_policy* ring = new ringfile_log_policy(opt.ring_size,
+                                                            RING_FILE_COUNT);
+        if (opt.shared)
+            ring->set_shared();
+        policy = ring;
+    } else {
+        file_log_policy* file = new file_log_policy();
+        if (opt.shared)
+            file->set_shared();
+        policy = file;
+    }
+
+    logger* log = new logger(policy, opt.filename);
+    std::string payload(opt.size, 'x');
+
+    for (long i = 0; i < opt.lines; i++)
+        log->LOG_INFO("bench ", process, " ", i, " ", payload);
+    delete log;
+}
+
+/* A line is "... bench <process> <number> <payload>", anything else
+ * (but the lines of the logger itself) is a torn line */
+static void check_file(const bench_options& opt, const std::string& filename,
+                       std::map<int, long>& last, long& count, long& torn)
+{
+    std::ifstream file(filename);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        size_t pos = line.find("bench ");
+        if (pos == std::string::npos) {
+            if (line.find("xxx") != std::string::npos)
+                torn++;
+            continue;
+        }
+
+        int process;
+        long number;
+        int len = 0;
+        if (sscanf(line.c_str() + pos, "bench %d %ld %n", &process, &number, &len) != 2 ||
+                line.size() - pos - len != opt.size ||
+                line.find_first_not_of('x', pos + len) != std::string::npos ||
+                line.find("bench ", pos + 1) != std::string::npos) {
+            torn++;
+            continue;
+        }
+
+        auto it = last.find(process);
+        if (it != last.end() && number <= it->second)
+            torn++;     // out of order, or a duplicate
+        last[process] = number;
+        count++;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bench_options opt;
+    int c;
+
+    while ((c = getopt(argc, argv, "p:n:s:r:u")) != -1) {
+        switch (c) {
+        case 'p': opt.processes = atoi(optarg); break;
+        case 'n': opt.lines = atol(optarg); break;
+        case 's': opt.size = atol(optarg); break;
+        case 'r': opt.ring_size = strtoull(optarg, nullptr, 10); break;
+        case 'u': opt.shared = false; break;
+        default: opt.processes = 0;
+        }
+    }
+    if (optind + 1 != argc || opt.processes <= 0 || opt.lines <= 0) {
+        fprintf(stderr, "Usage: %s [-p processes] [-n lines] [-s size] "
+                        "[-r max_size] [-u] file\n", argv[0]);
+        return 1;
+    }
+    opt.filename = argv[optind];
+
+    // Start from empty files
+    std::vector<std::string> files;
+    if (opt.ring_size) {
+        for (int i = 0; i < RING_FILE_COUNT; i++)
+            files.push_back(opt.filename + "." + std::to_string(i));
+        files.push_back(opt.filename + ".lock");
+    } else {
+        files.push_back(opt.filename);
+    }
+    for (const std::string& f : files) {
+        std::error_code error;
+        fs::remove(f, error);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < opt.processes; p++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_process(opt, p);
+            _exit(0);
+        }
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+    }
+    while (wait(nullptr) > 0) { }
+    double elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+
+    long count = 0;
+    long torn = 0;
+    std::map<int, long> last;
+    if (opt.ring_size) {
+        // The order is only checked in each file
+        for (int i = 0; i < RING_FILE_COUNT; i++) {
+            last.clear();
+            check_file(opt, files[i], last, count, torn);
+        }
+    } else {
+        check_file(opt, opt.filename, last, count, torn);
+    }
+
+    long total = opt.lines * opt.processes;
+    printf("%d processes, %ld lines of %zu bytes: %.3f s, %.0f lines/s",
+           opt.processes, total, opt.size, elapsed, total / elapsed);
+    if (!opt.ring_size)
+        printf(", %.1f MB/s", fs::file_size(opt.filename) / elapsed / 1048576);
+    printf("\n");
+    printf("lines read %ld, torn or out of order %ld", count, torn);
+    if (!opt.ring_size)
+        printf(", lost %ld", total - count);
+    printf("\n");
+
+    return torn || (!opt.ring_size && count != total) ? 2 : 0;
+}
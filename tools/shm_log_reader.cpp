@@ -0,0 +1,104 @@
+/*
+ * shm_log_reader.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Collector for shm_log_policy: read one or several shared memory
+ * rings and write their lines on stdout. Lost lines (collector too
+ * slow) are reported on stderr.
+ *
+ * Usage: shm_log_reader [-n] name [name ...]
+ *     -n   skip the lines already in the rings
+ *     name logger name without path, i.e. execution.log
+ */
+
+#include "shm_ring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static std::atomic<bool> running(true);
+
+static void stop(int sig)
+{
+    (void) sig;
+    running.store(false);
+}
+
+int main(int argc, char* argv[])
+{
+    bool from_start = true;
+    std::vector<std::unique_ptr<shm_ring_reader>> rings;
+    std::vector<std::string> names;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0)
+            from_start = false;
+        else
+            names.push_back(argv[i][0] == '/' ? argv[i] :
+                                            std::string("/") + argv[i]);
+    }
+    if (names.empty()) {
+        fprintf(stderr, "Usage: %s [-n] name [name ...]\n", argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    for (size_t i = 0; i < names.size(); i++)
+        rings.emplace_back(new shm_ring_reader());
+
+    std::string msg;
+    uint64_t lost;
+    unsigned int idle = 0;
+
+    while (running.load()) {
+        bool got_line = false;
+
+        for (size_t i = 0; i < rings.size(); i++) {
+            shm_ring_reader& ring = *rings[i];
+
+            // the writer may not be started yet, retry every ~100ms
+            if (!ring.is_open()) {
+                if (idle % 100 != 0 || !ring.open(names[i], from_start))
+                    continue;
+            }
+
+            while (ring.read(msg, lost)) {
+                if (lost)
+                    fprintf(stderr, "*** %s: %llu lines lost ***\n",
+                            names[i].c_str(), (unsigned long long) lost);
+                fwrite(msg.data(), 1, msg.size(), stdout);
+                got_line = true;
+            }
+        }
+
+        if (got_line) {
+            fflush(stdout);
+            idle = 0;
+        } else {
+            idle++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * shm_ring_check.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Check of shm_log_policy against shm_ring_reader, in 2 processes: a
+ * producer logs "check <thread> <number> <payload>" lines from several
+ * threads in a small ring, while a consumer reads it (slowed down with
+ * -d, to be overrun more often). Once the producer is done, the
+ * consumer reads what is left, then checks:
+ *  - lines read + lines lost (reported by the reader) = lines written
+ *  - the lines of a thread are in order, none is torn
+ * The exit status is not 0 if a check fails.
+ *
+ * Usage: shm_ring_check [-t threads] [-n lines] [-s size] [-c capacity]
+ *                       [-d delay_us]
+ *     -t   producer threads, default 4
+ *     -n   lines per thread, default 100000
+ *     -s   payload size in bytes, default 100
+ *     -c   ring capacity in bytes, default 65536
+ *     -d   sleep of the consumer after each line, default 0
+ */
+
+#include "logger.hpp"
+#include "shm_ring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct check_options
+{
+    int threads = 4;
+    long lines = 100000;
+    size_t size = 100;
+    uint64_t capacity = 65536;
+    unsigned int delay_us = 0;
+    std::string name;       // logger name, the shm name is "/" + name
+};
+
+static std::atomic<bool> producer_done(false);
+
+static void stop(int sig)
+{
+    (void) sig;
+    producer_done.store(true);
+}
+
+static void run_producer(const check_options& opt)
+{
+    logger* log = new logger(new shm_log_policy(opt.capacity), opt.name);
+    std::vector<std::thread> threads;
+    std::string payload(opt.size, 'x');
+
+    for (int t = 0; t < opt.threads; t++)
+        threads.emplace_back([&, t] {
+            for (long i = 0; i < opt.lines; i++)
+                log->LOG_INFO("check ", t, " ", i, " ", payload);
+        });
+    for (std::thread& thread : threads)
+        thread.join();
+    delete log;
+}
+
+/* Read until the producer is done and the ring is empty. The logger
+ * write one line of its own at the end ("activity terminated") */
+static int run_consumer(const check_options& opt)
+{
+    shm_ring_reader ring;
+    std::map<int, long> last;
+    std::string msg;
+    uint64_t lost;
+    uint64_t total_lost = 0;
+    long read = 0;
+    long torn = 0;
+    long disorder = 0;
+
+    for (;;) {
+        // The segment is created by the producer
+        bool done = producer_done.load();
+        if (!ring.is_open() && !ring.open("/" + opt.name)) {
+            if (done) {
+                fprintf(stderr, "/%s: no ring\n", opt.name.c_str());
+                return 2;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        bool got_line = false;
+        while (ring.read(msg, lost)) {
+            total_lost += lost;
+            read++;
+            got_line = true;
+
+            size_t pos = msg.find("check ");
+            if (pos != std::string::npos) {
+                int thread;
+                long number;
+                int len = 0;
+                if (sscanf(msg.c_str() + pos, "check %d %ld %n", &thread,
+                                                &number, &len) != 2 ||
+                        msg.size() - pos - len != opt.size + 1 ||
+                        msg.find_first_not_of('x', pos + len) != msg.size() - 1) {
+                    torn++;
+                } else {
+                    auto it = last.find(thread);
+                    if (it != last.end() && number <= it->second)
+                        disorder++;
+                    last[thread] = number;
+                }
+            }
+            if (opt.delay_us)
+                std::this_thread::sleep_for(std::chrono::microseconds(opt.delay_us));
+        }
+
+        // Nothing left once the producer has exited
+        if (done)
+            break;
+        if (!got_line)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    long written = opt.threads * opt.lines + 1;
+    printf("lines written %ld, read %ld, lost %llu, torn %ld, out of order %ld\n",
+           written, read, (unsigned long long)total_lost, torn, disorder);
+    fflush(stdout);     // left with _exit
+
+    if (read + (long)total_lost != written) {
+        fprintf(stderr, "read + lost != written\n");
+        return 2;
+    }
+    return torn || disorder ? 2 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    check_options opt;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:n:s:c:d:")) != -1) {
+        switch (c) {
+        case 't': opt.threads = atoi(optarg); break;
+        case 'n': opt.lines = atol(optarg); break;
+        case 's': opt.size = atol(optarg); break;
+        case 'c': opt.capacity = strtoull(optarg, nullptr, 10); break;
+        case 'd': opt.delay_us = atoi(optarg); break;
+        default: opt.threads = 0;
+        }
+    }
+    if (optind != argc || opt.threads <= 0 || opt.lines <= 0 ||
+            opt.capacity < 4096) {
+        fprintf(stderr, "Usage: %s [-t threads] [-n lines] [-s size] "
+                        "[-c capacity] [-d delay_us]\n", argv[0]);
+        return 1;
+    }
+    opt.name = "shm_ring_check." + std::to_string(getpid());
+
+    // Before the fork, the consumer may be told to stop at once
+    signal(SIGTERM, stop);
+    pid_t consumer = fork();
+    if (consumer == 0)
+        _exit(run_consumer(opt));
+    if (consumer < 0) {
+        perror("fork");
+        return 1;
+    }
+
+    pid_t producer = fork();
+    if (producer == 0) {
+        run_producer(opt);
+        _exit(0);
+    }
+    if (producer < 0) {
+        perror("fork");
+        kill(consumer, SIGKILL);
+        return 1;
+    }
+
+    int producer_status;
+    int consumer_status;
+    waitpid(producer, &producer_status, 0);
+    kill(consumer, SIGTERM);
+    waitpid(consumer, &consumer_status, 0);
+    shm_unlink(("/" + opt.name).c_str());
+
+    if (!WIFEXITED(producer_status) || WEXITSTATUS(producer_status) != 0) {
+        fprintf(stderr, "producer failed\n");
+        return 2;
+    }
+    if (!WIFEXITED(consumer_status))
+        return 2;
+    return WEXITSTATUS(consumer_status);
+}
@@ -0,0 +1,184 @@
+/*
+ * shutdown_bench.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Several loggers, one thread each, queue their lines, then all the
+ * loggers are stopped at once: report the time of the shutdown, then
+ * check that no line queued before it is lost.
+ *
+ * Usage: shutdown_bench [-l loggers] [-n lines] [-t timeout] [-s]
+ *                       [-e exit|quick_exit] dir
+ *     -l   loggers, default 50
+ *     -n   lines per logger, default 10000
+ *     -t   timeout of shutdown_all in ms, default LOGGER_SHUTDOWN_TIMEOUT
+ *     -s   delete the loggers one by one instead, to compare
+ *     -e   don't stop the loggers: a child process log then call exit()
+ *          or quick_exit(), the exit handler shall write the lines. The
+ *          main thread log the last line of each logger, its
+ *          thread_locals are destroyed before the handler run on exit()
+ */
+
+#include "logger.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+struct bench_options
+{
+    int loggers = 50;
+    long lines = 10000;
+    long timeout = LOGGER_SHUTDOWN_TIMEOUT;
+    bool serial = false;
+    std::string exit_mode;
+    std::string dir;
+};
+
+static std::string log_filename(const bench_options& opt, int index)
+{
+    return opt.dir + "/shutdown." + std::to_string(index) + ".log";
+}
+
+/* Queue the lines, return the loggers still running */
+static std::vector<logger*> run_loggers(const bench_options& opt)
+{
+    std::vector<logger*> loggers;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < opt.loggers; i++)
+        loggers.push_back(new logger(new file_log_policy(), log_filename(opt, i)));
+
+    for (int i = 0; i < opt.loggers; i++)
+        threads.emplace_back([&opt, log = loggers[i], i] {
+            for (long n = 0; n < opt.lines; n++)
+                log->LOG_INFO("shutdown ", i, " ", n);
+        });
+    for (auto& thread : threads)
+        thread.join();
+    return loggers;
+}
+
+/* Every line "shutdown <logger> <n>" shall be there, in order, with
+ * one more of the main thread with -e */
+static long check_file(const bench_options& opt, int index)
+{
+    long lines = opt.exit_mode.empty() ? opt.lines : opt.lines + 1;
+    std::ifstream file(log_filename(opt, index));
+    std::string line;
+    long next = 0;
+    long errors = 0;
+
+    while (std::getline(file, line)) {
+        size_t pos = line.find("shutdown ");
+        if (pos == std::string::npos)
+            continue;
+        int logger_index;
+        long n;
+        if (sscanf(line.c_str() + pos, "shutdown %d %ld", &logger_index, &n) != 2 ||
+                logger_index != index || n != next)
+            errors++;
+        next = n + 1;
+    }
+    return errors + (lines - next);
+}
+
+int main(int argc, char* argv[])
+{
+    bench_options opt;
+    int c;
+
+    while ((c = getopt(argc, argv, "l:n:t:se:")) != -1) {
+        switch (c) {
+        case 'l': opt.loggers = atoi(optarg); break;
+        case 'n': opt.lines = atol(optarg); break;
+        case 't': opt.timeout = atol(optarg); break;
+        case 's': opt.serial = true; break;
+        case 'e': opt.exit_mode = optarg; break;
+        default: opt.loggers = 0;
+        }
+    }
+    if (optind + 1 != argc || opt.loggers <= 0 || opt.lines <= 0 ||
+            (!opt.exit_mode.empty() && opt.exit_mode != "exit" &&
+                                       opt.exit_mode != "quick_exit")) {
+        fprintf(stderr, "Usage: %s [-l loggers] [-n lines] [-t timeout] [-s] "
+                        "[-e exit|quick_exit] dir\n", argv[0]);
+        return 1;
+    }
+    opt.dir = argv[optind];
+
+    std::error_code error;
+    fs::create_directories(opt.dir, error);
+    for (int i = 0; i < opt.loggers; i++)
+        fs::remove(log_filename(opt, i), error);
+
+    auto start = std::chrono::steady_clock::now();
+    bool complete = true;
+
+    if (!opt.exit_mode.empty()) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            logger::install_exit_handler(std::chrono::milliseconds(opt.timeout));
+            std::vector<logger*> loggers = run_loggers(opt);
+            for (int i = 0; i < opt.loggers; i++) {
+                loggers[i]->set_thread_name("main");
+                loggers[i]->LOG_INFO("shutdown ", i, " ", opt.lines);
+            }
+            if (opt.exit_mode == "exit")
+                exit(0);
+            quick_exit(0);
+        }
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        int status;
+        waitpid(pid, &status, 0);
+    } else {
+        std::vector<logger*> loggers = run_loggers(opt);
+        start = std::chrono::steady_clock::now();
+        if (opt.serial) {
+            for (logger* log : loggers)
+                delete log;
+        } else {
+            complete = logger::shutdown_all(std::chrono::milliseconds(opt.timeout));
+        }
+    }
+    double elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+
+    long lost = 0;
+    for (int i = 0; i < opt.loggers; i++)
+        lost += check_file(opt, i);
+
+    printf("%d loggers, %ld lines each: %s in %.3f ms%s\n", opt.loggers,
+           opt.lines, opt.exit_mode.empty() ? (opt.serial ? "deleted" :
+           "shut down") : "process exited", elapsed * 1000,
+           complete ? "" : " (timeout)");
+    printf("lines lost or out of order %ld\n", lost);
+
+    return lost ? 2 : 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * syslog_check.cpp
+ *
+ * Written by Akira Shimahara
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Check of unix_socket_log_policy and syslog_log_policy against an
+ * AF_UNIX SOCK_DGRAM listener bound by the tool:
+ *  - severity: the PRI of each log_level (RFC5424, debug = 7 ...
+ *    critical = 2), the version, APP-NAME and MSG fields
+ *  - timestamp: the TIMESTAMP is when the line was logged, not when
+ *    its batch was sent
+ *  - batch: nothing is sent before the flush, then every line is
+ *    delivered in order, several datagrams per flush
+ *  - rebind: the listener is closed then bound again, the lines are
+ *    kept meanwhile up to max_pending, the oldest are dropped, and the
+ *    count of dropped lines is sent first once the connection is back
+ *  - no block: with a listener that never reads (queue full), a flush
+ *    never wait, and a logger logging many lines is never slowed down
+ * The exit status is not 0 if a check fails.
+ *
+ * Usage: syslog_check [-n lines] [socket_path]
+ *     -n   lines of the no block check, default 100000
+ *     socket_path default /tmp/syslog_check.<pid>.sock
+ */
+
+#include "logger.hpp"
+#include "log_clock.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief check_listener the log daemon side, a bound datagram socket
+ */
+class check_listener
+{
+public:
+    explicit check_listener(const std::string& path) : _path(path), _fd(-1) { }
+    ~check_listener() { close(); }
+
+    bool bind() {
+        struct sockaddr_un addr = {};
+
+        close();
+        if (_path.size() >= sizeof(addr.sun_path))
+            return false;
+        unlink(_path.c_str());
+        _fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (_fd < 0)
+            return false;
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, _path.c_str(), _path.size());
+        if (::bind(_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+            unlink(_path.c_str());
+        }
+    }
+
+    /** @brief receive() append the datagrams received until none
+     *  @brief arrive for timeout_ms
+     *  @return count of datagrams received
+     */
+    size_t receive(std::vector<std::string>& datagrams, int timeout_ms) {
+        struct pollfd pfd = { _fd, POLLIN, 0 };
+        char buffer[65536];
+        size_t count = 0;
+
+        while (_fd >= 0 && poll(&pfd, 1, timeout_ms) > 0) {
+            ssize_t len = recv(_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (len < 0)
+                break;
+            datagrams.emplace_back(buffer, len);
+            count++;
+        }
+        return count;
+    }
+
+private:
+    std::string _path;
+    int _fd;
+};
+
+static int failures = 0;
+
+static void report(const char* check, bool ok, const std::string& detail)
+{
+    printf("%-10s %s%s%s\n", check, ok ? "ok" : "FAILED",
+           detail.empty() ? "" : ": ", detail.c_str());
+    if (!ok)
+        failures++;
+}
+
+static log_record check_line(long number, log_level level = log_level::info)
+{
+    return log_record{ level, "line " + std::to_string(number) + "\n" };
+}
+
+/* Flush and read in turn, the queue of the listener is short
+ * (net.unix.max_dgram_qlen), until nothing more arrive */
+static void flush_all(unix_socket_log_policy& policy, check_listener& listener,
+                      std::vector<std::string>& datagrams)
+{
+    do {
+        policy.flush();
+    } while (listener.receive(datagrams, 20) != 0);
+}
+
+/* Number of a "line N" datagram, -1 if it is not one */
+static long line_number(const std::string& datagram)
+{
+    size_t pos = datagram.rfind("line ");
+    return pos == std::string::npos ? -1 : atol(datagram.c_str() + pos + 5);
+}
+
+static bool in_order(const std::vector<std::string>& datagrams, size_t first,
+                     long from, long to)
+{
+    if (datagrams.size() - first != (size_t)(to - from))
+        return false;
+    for (long i = from; i < to; i++)
+        if (line_number(datagrams[first + i - from]) != i)
+            return false;
+    return true;
+}
+
+static void check_severity(const std::string& path)
+{
+    check_listener listener(path);
+    if (!listener.bind())
+        return report("severity", false, "bind " + path);
+
+    const unsigned int facility = 16;   // local0
+    syslog_log_policy policy(path, facility, "syslog_check");
+    policy.open_out_stream("/tmp/syslog_check");
+
+    for (int level = (int)log_level::debug; level <= (int)log_level::critical; level++)
+        policy.write_record(check_line(level, (log_level)level));
+
+    std::vector<std::string> datagrams;
+    flush_all(policy, listener, datagrams);
+    policy.close_out_stream();
+
+    std::string detail;
+    const unsigned int severity[] = { 7, 6, 5, 4, 3, 2 };
+    if (datagrams.size() != 6)
+        detail = std::to_string(datagrams.size()) + " datagrams";
+    for (size_t i = 0; detail.empty() && i < datagrams.size(); i++) {
+        std::string pri = "<" + std::to_string(facility * 8 + severity[i]) + ">1 ";
+        if (datagrams[i].compare(0, pri.size(), pri) != 0 ||
+                datagrams[i].find(" syslog_check " + std::to_string(getpid()) +
+                                  " - - ") == std::string::npos ||
+                line_number(datagrams[i]) != (long)i + 1 ||
+                datagrams[i].back() == '\n')
+            detail = "\"" + datagrams[i] + "\"";
+    }
+    report("severity", detail.empty(), detail);
+}
+
+/* TIMESTAMP of a syslog datagram in us since the epoch, -1 if invalid */
+static int64_t datagram_us(const std::string& datagram)
+{
+    std::tm tm = {};
+    long us;
+    int len = 0;
+
+    size_t pos = datagram.find(' ');
+    if (pos == std::string::npos)
+        return -1;
+    const char* end = strptime(datagram.c_str() + pos + 1, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (!end || sscanf(end, ".%6ldZ%n", &us, &len) != 1 || len != 8)
+        return -1;
+    return (int64_t)timegm(&tm) * 1000000 + us;
+}
+
+static void check_timestamp(const std::string& path)
+{
+    check_listener listener(path);
+    if (!listener.bind())
+        return report("timestamp", false, "bind " + path);
+
+    syslog_log_policy policy(path, 1, "syslog_check");
+    policy.open_out_stream("/tmp/syslog_check");
+
+    // 2 lines logged 50ms apart, sent in the same batch
+    std::vector<int64_t> expected;
+    for (long i = 0; i < 2; i++) {
+        log_record record = check_line(i);
+        record.timestamp = log_clock::now();
+        expected.push_back(log_clock::to_realtime_ns(record.timestamp) / 1000);
+        policy.write_record(record);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    std::vector<std::string> datagrams;
+    flush_all(policy, listener, datagrams);
+    policy.close_out_stream();
+
+    std::string detail;
+    if (datagrams.size() != expected.size())
+        detail = std::to_string(datagrams.size()) + " datagrams";
+    for (size_t i = 0; detail.empty() && i < datagrams.size(); i++)
+        if (datagram_us(datagrams[i]) != expected[i])
+            detail = "\"" + datagrams[i] + "\"";
+    report("timestamp", detail.empty(), detail);
+}
+
+static void check_batch(const std::string& path)
+{
+    check_listener listener(path);
+    if (!listener.bind())
+        return report("batch", false, "bind " + path);
+
+    const long lines = UNIX_SOCKET_BATCH * 4;
+    unix_socket_log_policy policy(path, lines);
+    policy.open_out_stream("/tmp/syslog_check");
+
+    std::vector<std::string> datagrams;
+    for (long i = 0; i < lines; i++)
+        policy.write_record(check_line(i));
+    listener.receive(datagrams, 20);
+    size_t before_flush = datagrams.size();
+
+    policy.flush();
+    size_t first_flush = listener.receive(datagrams, 20);
+    flush_all(policy, listener, datagrams);
+    policy.close_out_stream();
+
+    std::string detail = std::to_string(first_flush) + " datagrams on the first flush, " +
+                         std::to_string(datagrams.size()) + " of " +
+                         std::to_string(lines) + " in all";
+    report("batch", before_flush == 0 && first_flush > 1 &&
+                    in_order(datagrams, 0, 0, lines), detail);
+}
+
+static void check_rebind(const std::string& path)
+{
+    check_listener listener(path);
+    if (!listener.bind())
+        return report("rebind", false, "bind " + path);
+
+    const size_t max_pending = 100;
+    unix_socket_log_policy policy(path, max_pending);
+    policy.open_out_stream("/tmp/syslog_check");
+
+    std::vector<std::string> datagrams;
+    long number = 0;
+    for (; number < 10; number++)
+        policy.write_record(check_line(number));
+    flush_all(policy, listener, datagrams);
+    bool delivered = in_order(datagrams, 0, 0, 10);
+
+    // Daemon down: the send fail, the lines are kept
+    listener.close();
+    for (; number < 15; number++)
+        policy.write_record(check_line(number));
+    policy.flush();
+
+    // Back, but the policy wait UNIX_SOCKET_RETRY_MS to reconnect
+    if (!listener.bind())
+        return report("rebind", false, "bind again " + path);
+    for (; number < 265; number++)
+        policy.write_record(check_line(number));
+    policy.flush();
+    datagrams.clear();
+    size_t early = listener.receive(datagrams, 20);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(UNIX_SOCKET_RETRY_MS + 100));
+    flush_all(policy, listener, datagrams);
+    policy.close_out_stream();
+
+    // The last max_pending lines, after the count of the dropped ones
+    long dropped = number - 10 - max_pending;
+    std::string note = std::to_string(dropped) + " lines dropped";
+    bool ok = delivered && early == 0 && !datagrams.empty() &&
+              datagrams[0].compare(0, note.size(), note) == 0 &&
+              in_order(datagrams, 1, number - max_pending, number);
+    report("rebind", ok, std::to_string(datagrams.size()) + " datagrams after the rebind" +
+                         (datagrams.empty() ? "" : ", first \"" + datagrams[0] + "\""));
+}
+
+static void check_no_block(const std::string& path, long lines)
+{
+    check_listener listener(path);
+    if (!listener.bind())
+        return report("no block", false, "bind " + path);
+
+    // The listener never read: its queue is full after a few lines
+    unix_socket_log_policy policy(path, 1000);
+    policy.open_out_stream("/tmp/syslog_check");
+    double max_flush_ms = 0;
+    for (long i = 0; i < 5000; i++) {
+        policy.write_record(check_line(i));
+        auto start = std::chrono::steady_clock::now();
+        policy.flush();
+        double ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+        if (ms > max_flush_ms)
+            max_flush_ms = ms;
+    }
+    policy.close_out_stream();
+
+    // Same through a logger: the daemon keep up, the lines are dropped
+    auto start = std::chrono::steady_clock::now();
+    logger* log = new logger(new syslog_log_policy(path, 1, "", 1000),
+                             "/tmp/syslog_check");
+    for (long i = 0; i < lines; i++)
+        log->LOG_INFO("line ", i);
+    delete log;
+    double seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start).count();
+
+    char detail[128];
+    snprintf(detail, sizeof(detail), "max flush %.3f ms, logger %ld lines in %.3f s",
+             max_flush_ms, lines, seconds);
+    report("no block", max_flush_ms < 100 && seconds < 10, detail);
+}
+
+int main(int argc, char* argv[])
+{
+    long lines = 100000;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+        case 'n': lines = atol(optarg); break;
+        default: lines = 0;
+        }
+    }
+    if (lines <= 0 || optind + 1 < argc) {
+        fprintf(stderr, "Usage: %s [-n lines] [socket_path]\n", argv[0]);
+        return 1;
+    }
+    std::string path = optind < argc ? argv[optind] :
+                "/tmp/syslog_check." + std::to_string(getpid()) + ".sock";
+
+    check_severity(path);
+    check_timestamp(path);
+    check_batch(path);
+    check_rebind(path);
+    check_no_block(path, lines);
+    return failures ? 2 : 0;
+}